@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "SCA.h"
+
+/*
+  Throughput benchmark for the sound change engine.
+
+  For each script, this generates a lexicon of random words from the
+  script's own phonemes and times each phase of applying the script to
+  it. The words depend only on the script and the seed, so the numbers
+  can be compared before and after a change to the engine. The output
+  hash should stay the same unless the change is meant to change the
+  output.
+
+  Allocations are counted by replacing the global operator new, so
+  anything that Lua allocates isn't included.
+*/
+
+const char* usage = R".(Usage:
+  %s [options...] <script.zt...>
+
+  * -n <count=20000>: the number of words to generate for each script
+  * -s <seed=1>: the seed for the word generator
+).";
+
+static size_t nAllocs = 0;
+
+void* operator new(size_t n) {
+  ++nAllocs;
+  void* p = malloc(n != 0 ? n : 1);
+  if (p == nullptr) abort();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+struct Config {
+  std::vector<const char*> scripts;
+  size_t nWords = 20000;
+  unsigned seed = 1;
+};
+
+void parse(Config& c, int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "-n") == 0 && i + 1 < argc) {
+      c.nWords = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "-s") == 0 && i + 1 < argc) {
+      c.seed = strtoul(argv[++i], nullptr, 10);
+    } else if (arg[0] == '-') {
+      fprintf(stderr, usage, argv[0]);
+      exit(1);
+    } else {
+      c.scripts.push_back(arg);
+    }
+  }
+  if (c.scripts.empty() || c.nWords == 0) {
+    fprintf(stderr, usage, argv[0]);
+    exit(1);
+  }
+}
+
+// Measures the time and allocations between its construction and the
+// call to `finish`.
+class Phase {
+public:
+  Phase(const char* name) :
+    name(name), allocs(nAllocs), start(std::chrono::steady_clock::now()) {}
+  void finish(size_t nWords) {
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    size_t n = nAllocs - allocs;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("  %-10s %10.3f %12.0f %10.1f %12.2f %12ld\n",
+      name, ns / 1e6, nWords / (ns / 1e9), ns / nWords,
+      (double) n / nWords, ru.ru_maxrss);
+  }
+private:
+  const char* name;
+  size_t allocs;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Make up `n` words from the phonemes of `sca`. If it has at least two
+// classes, then the one with the fewest phonemes provides the nuclei of
+// syllables and the others provide onsets and codas. Otherwise, the
+// phonemes are strung together at random.
+std::vector<std::string> generateWords(
+    const sca::SCA& sca, size_t n, unsigned seed) {
+  std::vector<std::vector<const std::string*>> byClass(sca.getClassCount());
+  std::vector<const std::string*> all;
+  for (size_t id = 0; id < sca.getPhonemeCount(); ++id) {
+    const sca::PhonemeSpec& ps = sca.getPhonemeByID(id);
+    all.push_back(&ps.name);
+    if (ps.charClass != -1) byClass[ps.charClass].push_back(&ps.name);
+  }
+  std::vector<std::vector<const std::string*>> classes;
+  for (auto& c : byClass) {
+    if (!c.empty()) classes.push_back(std::move(c));
+  }
+  std::mt19937 rng(seed);
+  auto pick = [&rng](const std::vector<const std::string*>& v) {
+    return *v[std::uniform_int_distribution<size_t>(0, v.size() - 1)(rng)];
+  };
+  auto chance = [&rng](double p) {
+    return std::bernoulli_distribution(p)(rng);
+  };
+  std::vector<std::string> words;
+  if (all.empty()) return words;
+  size_t nucleus = 0;
+  for (size_t i = 1; i < classes.size(); ++i) {
+    if (classes[i].size() < classes[nucleus].size()) nucleus = i;
+  }
+  std::uniform_int_distribution<size_t> margin(0, classes.size() - 2);
+  auto pickMargin = [&]() {
+    size_t i = margin(rng);
+    return pick(classes[(i >= nucleus) ? i + 1 : i]);
+  };
+  for (size_t i = 0; i < n; ++i) {
+    std::string word;
+    size_t nSyllables = std::uniform_int_distribution<size_t>(1, 4)(rng);
+    for (size_t j = 0; j < nSyllables; ++j) {
+      if (classes.size() < 2) {
+        word += pick(all);
+        word += pick(all);
+        continue;
+      }
+      if (chance(0.8)) word += pickMargin();
+      word += pick(classes[nucleus]);
+      if (chance(0.3)) word += pickMargin();
+    }
+    words.push_back(std::move(word));
+  }
+  return words;
+}
+
+void runScript(const Config& c, const char* path) {
+  std::ifstream fh(path);
+  if (!fh) {
+    fprintf(stderr, "Could not open %s\n", path);
+    return;
+  }
+  std::stringstream buffer;
+  buffer << fh.rdbuf();
+  std::string source = buffer.str();
+  size_t n = c.nWords;
+  printf("%s\n", path);
+  printf("  %-10s %10s %12s %10s %12s %12s\n",
+    "phase", "time/ms", "words/s", "ns/word", "allocs/word", "peak RSS/KiB");
+  Phase parsePhase("lex/parse");
+  std::istringstream in(source);
+  sca::Lexer lexer(&in);
+  auto mysca = std::make_unique<sca::SCA>();
+  sca::Parser parser(&lexer, mysca.get());
+  if (!parser.parse()) {
+    printf("  could not parse; skipping\n");
+    return;
+  }
+  parsePhase.finish(n);
+  Phase verifyPhase("verify");
+  std::vector<sca::Error> errors;
+  mysca->verify(errors);
+  if (!errors.empty()) {
+    printf("  could not verify; skipping\n");
+    return;
+  }
+  mysca->reversePhonemeMap();
+  std::vector<sca::DeadRule> dead;
+  mysca->eliminateDeadRules(dead);
+  mysca->fuseRules();
+  if (!mysca->executeGlobalLuaCode().empty()) {
+    printf("  could not run global Lua code; skipping\n");
+    return;
+  }
+  verifyPhase.finish(n);
+  std::vector<std::string> words = generateWords(*mysca, n, c.seed);
+  std::vector<sca::WString> tokenized;
+  tokenized.reserve(n);
+  Phase tokenizePhase("tokenize");
+  for (const std::string& w : words) tokenized.push_back(mysca->tokenize(w));
+  tokenizePhase.finish(n);
+  Phase applyPhase("apply");
+  for (sca::WString& ws : tokenized) {
+    // The words themselves were allocated outside of the scope, so only
+    // the scratch memory comes from the arena (as it would in SCA::apply).
+    sca::ArenaScope scratch;
+    mysca->applySoundChanges(ws, "");
+  }
+  applyPhase.finish(n);
+  std::vector<std::string> outputs;
+  outputs.reserve(n);
+  Phase renderPhase("render");
+  for (const sca::WString& ws : tokenized)
+    outputs.push_back(mysca->wStringToString(ws));
+  renderPhase.finish(n);
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325;
+  for (const std::string& s : outputs) {
+    for (char ch : s) hash = (hash ^ (unsigned char) ch) * 0x100000001b3;
+    hash = (hash ^ '\n') * 0x100000001b3;
+  }
+  printf("  %zu words, output hash %016llx\n",
+    words.size(), (unsigned long long) hash);
+}
+
+int main(int argc, char** argv) {
+  Config c;
+  parse(c, argc, argv);
+  for (const char* path : c.scripts) runScript(c, path);
+  return 0;
+}
@@ -0,0 +1,251 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Lexer.h"
+#include "Parser.h"
+#include "SCA.h"
+#include "iterutils.h"
+#include "matching.h"
+
+/*
+  Microbenchmarks for the hot paths of the matcher.
+
+  Each benchmark runs over the same fixed-seed inputs several times and
+  reports the best time per operation. The patterns come from the sound
+  changes in the script below.
+*/
+
+const char* script = R".(
+class C = p t k b d g f s x m n;
+class V = a e i o u;
+feature voice { n*: p t k f s x; y: b d g m n; }
+feature front { n*: a o u; y: e i; }
+feature height ordered { lo*: a; mid: e o; hi: i u; }
+# literal
+p a -> b a;
+# constraints
+$(C:1|voice=n) $(V:2|front=y) -> $(C:1|voice=y) $(V:2);
+# enumeration
+$(V:1/a,e) -> $(V:1/e,i);
+# alternation
+[p | t | k] $(V:1) -> $(V:1);
+# repetition, ordered comparison
+[$(C:2)]+ $(V:1|height>lo) -> a;
+).";
+
+// Sound changes that keep going after each replacement, for benchLoops.
+const char* loopScript = R".(
+class C = p t;
+-> a (p _) / loopsi;
+a -> / rtl loopsi;
+).";
+
+const size_t nWords = 1000;
+const unsigned seed = 12345;
+const int runs = 5;
+const size_t repeats = 20;
+
+static volatile size_t sink;
+
+// Time `fn`, which performs `ops` operations and returns something to
+// feed to the sink, and print the best time per operation.
+template<typename F>
+void bench(const char* name, size_t ops, F&& fn) {
+  double best = -1;
+  for (int r = 0; r < runs; ++r) {
+    auto start = std::chrono::steady_clock::now();
+    size_t acc = 0;
+    for (size_t i = 0; i < repeats; ++i) acc += fn();
+    auto end = std::chrono::steady_clock::now();
+    sink = acc;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    if (best < 0 || ns < best) best = ns;
+  }
+  printf("%-34s %10.2f ns/op\n", name, best / (repeats * ops));
+}
+
+std::vector<std::string> generateWords(const sca::SCA& sca) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<size_t> len(8, 16);
+  std::uniform_int_distribution<size_t> ph(0, sca.getPhonemeCount() - 1);
+  std::vector<std::string> words;
+  for (size_t i = 0; i < nWords; ++i) {
+    std::string w;
+    size_t n = len(rng);
+    for (size_t j = 0; j < n; ++j) w += sca.getPhonemeByID(ph(rng)).name;
+    words.push_back(std::move(w));
+  }
+  return words;
+}
+
+const sca::SimpleRule& getRule(const sca::SCA& sca, size_t i) {
+  return *sca.getSoundChange(i).rule->getSimpleRules().first;
+}
+
+void benchPatterns(const sca::SCA& sca, std::vector<sca::WString>& words) {
+  const char* names[] = {
+    "literal", "constraint", "enumeration", "alternation", "repeat",
+  };
+  size_t positions = 0;
+  for (const sca::WString& w : words) positions += w.size();
+  for (size_t ri = 0; ri < sca.getSoundChangeCount(); ++ri) {
+    const sca::MString& alpha = getRule(sca, ri).alpha;
+    std::string name = std::string("matchesPattern LTR ") + names[ri];
+    bench(name.c_str(), positions, [&]() {
+      size_t n = 0;
+      sca::MatchCapture mc;
+      for (sca::WString& w : words) {
+        for (size_t i = 0; i < w.size(); ++i) {
+          mc.clear();
+          n += sca::matchPatternLTR(sca, w, i, alpha, mc).has_value();
+        }
+      }
+      return n;
+    });
+    name = std::string("matchesPattern RTL ") + names[ri];
+    bench(name.c_str(), positions, [&]() {
+      size_t n = 0;
+      sca::MatchCapture mc;
+      for (sca::WString& w : words) {
+        for (size_t i = 0; i < w.size(); ++i) {
+          mc.clear();
+          n += sca::matchPatternRTL(sca, w, i, alpha, mc).has_value();
+        }
+      }
+      return n;
+    });
+  }
+}
+
+void benchMatchers(const sca::SCA& sca, const std::vector<sca::WString>& words) {
+  std::vector<const sca::PhonemeSpec*> phonemes;
+  for (const sca::WString& w : words) {
+    for (const auto& p : w) phonemes.push_back(p.get());
+  }
+  const sca::MChar& constraint = getRule(sca, 1).alpha[0];
+  const sca::MChar& enumeration = getRule(sca, 2).alpha[0];
+  const sca::MChar& ordered = getRule(sca, 4).alpha[1];
+  auto benchCharsMatch = [&](const char* name, const sca::MChar& ch) {
+    bench(name, phonemes.size(), [&]() {
+      size_t n = 0;
+      sca::MatchCapture mc;
+      for (const sca::PhonemeSpec* ps : phonemes) {
+        mc.clear();
+        n += sca::charsMatch(sca, ch, *ps, mc);
+      }
+      return n;
+    });
+  };
+  benchCharsMatch("charsMatch constraint", constraint);
+  benchCharsMatch("charsMatch enumeration", enumeration);
+  auto benchConstraint = [&](const char* name, const sca::MChar& ch) {
+    const auto& con = ch.as<sca::CharMatcher>().getConstraints()[0];
+    const sca::MatchCapture mc;
+    bench(name, phonemes.size(), [&]() {
+      size_t n = 0;
+      for (const sca::PhonemeSpec* ps : phonemes)
+        n += con.matches(ps->getFeatureValue(con.feature, sca), mc, sca);
+      return n;
+    });
+  };
+  benchConstraint("Constraint::matches =", constraint);
+  benchConstraint("Constraint::matches >", ordered);
+  // Capture every phoneme that the constraint matcher accepts, and rewrite
+  // its features as in ω.
+  std::vector<sca::MatchCapture> captures;
+  for (const sca::PhonemeSpec* ps : phonemes) {
+    sca::MatchCapture mc;
+    if (sca::charsMatch(sca, constraint, *ps, mc))
+      captures.push_back(mc);
+  }
+  const sca::MChar& omega = getRule(sca, 1).omega[0];
+  bench("applyOmega feature rewrite", captures.size(), [&]() {
+    size_t n = 0;
+    for (const sca::MatchCapture& mc : captures)
+      n += sca::applyOmega(sca, omega, mc)->id;
+    return n;
+  });
+}
+
+void benchWords(const sca::SCA& sca, const std::vector<std::string>& strings) {
+  bench("splitIntoPhonemes", strings.size(), [&]() {
+    size_t n = 0;
+    sca::MString ms;
+    for (const std::string& s : strings) {
+      ms.clear();
+      sca::splitIntoPhonemes(sca, s, ms);
+      n += ms.size();
+    }
+    return n;
+  });
+  std::vector<sca::WString> words;
+  for (const std::string& s : strings) words.push_back(sca.tokenize(s));
+  const sca::PhonemeSpec& a = sca.getPhonemeByID(0);
+  sca::WString one, two;
+  one.resize(1);
+  two.resize(2);
+  // Grow each word by one phoneme in the middle, then shrink it back.
+  bench("replaceSubrange", 2 * words.size(), [&]() {
+    size_t n = 0;
+    for (sca::WString& w : words) {
+      size_t mid = w.size() / 2;
+      two[0] = sca::makePObserver(a);
+      two[1] = sca::makePObserver(a);
+      sca::replaceSubrange(w, mid, mid + 1, two.begin(), two.end());
+      one[0] = sca::makePObserver(a);
+      sca::replaceSubrange(w, mid, mid + 2, one.begin(), one.end());
+      n += w.size();
+    }
+    return n;
+  });
+}
+
+// Insert a phoneme after every other one in a long word, then delete them
+// again from the right. The time per phoneme should stay the same as the
+// word gets longer.
+void benchLoops(const sca::SCA& sca) {
+  for (size_t n : {1000, 10000, 100000}) {
+    std::string s;
+    for (size_t i = 0; i < n / 2; ++i) s += "pt";
+    sca::WString w = sca.tokenize(s);
+    std::string name = "loopsi edits, " + std::to_string(n) + " phonemes";
+    bench(name.c_str(), n, [&]() {
+      sca.getSoundChange(0).apply(sca, w);
+      sca.getSoundChange(1).apply(sca, w);
+      return w.size();
+    });
+  }
+}
+
+bool load(const char* text, sca::SCA& sca) {
+  std::istringstream in(text);
+  sca::Lexer lexer(&in);
+  sca::Parser parser(&lexer, &sca);
+  if (!parser.parse()) return false;
+  std::vector<sca::Error> errors;
+  sca.verify(errors);
+  for (const sca::Error& e : errors)
+    sca::printError(e);
+  if (!errors.empty()) return false;
+  sca.reversePhonemeMap();
+  return true;
+}
+
+int main() {
+  sca::SCA mysca, loopSCA;
+  if (!load(script, mysca) || !load(loopScript, loopSCA)) return 1;
+  std::vector<std::string> strings = generateWords(mysca);
+  std::vector<sca::WString> words;
+  for (const std::string& s : strings) words.push_back(mysca.tokenize(s));
+  benchPatterns(mysca, words);
+  benchMatchers(mysca, words);
+  benchWords(mysca, strings);
+  benchLoops(loopSCA);
+  return 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace sca {
+  // A bump allocator for scratch memory that only lives while one word is
+  // being processed. Freeing memory is a no-op; instead, everything
+  // allocated since a mark is reclaimed at once by releasing the arena to
+  // that mark (see ArenaScope). Chunks are kept for reuse, so once the
+  // arena has grown large enough, it stops allocating.
+  class Arena {
+  public:
+    struct Mark {
+      size_t chunk, offset;
+    };
+    void* allocate(size_t n, size_t align);
+    Mark mark() const { return {chunk, offset}; }
+    void release(Mark m) {
+      chunk = m.chunk;
+      offset = m.offset;
+    }
+    // The total size of the chunks that this arena owns.
+    size_t capacity() const;
+  private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    struct Chunk {
+      std::unique_ptr<char[]> data;
+      size_t size;
+    };
+    std::vector<Chunk> chunks;
+    size_t chunk = 0, offset = 0;
+  };
+  // The arena that ArenaAllocators created on this thread draw from, or
+  // null if there is none (in which case they use the heap).
+  extern thread_local Arena* scratchArena;
+  // While an ArenaScope exists, scratchArena points to this thread's
+  // arena. When it is destroyed, everything allocated from the arena
+  // during its lifetime is freed, so nothing allocated in the scope may
+  // outlive it. Scopes can nest.
+  class ArenaScope {
+  public:
+    ArenaScope();
+    ~ArenaScope();
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+  private:
+    Arena* previous;
+    Arena::Mark m;
+  };
+  // Returns the arena used by ArenaScopes on this thread.
+  Arena& getThreadArena();
+  // An allocator that uses the arena that was current when it was
+  // created, or the heap if there was none.
+  template<typename T>
+  class ArenaAllocator {
+  public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    ArenaAllocator() : arena(scratchArena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+    T* allocate(size_t n) {
+      if (arena == nullptr)
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+      return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t) {
+      if (arena == nullptr) ::operator delete(p);
+    }
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+      return arena == other.arena;
+    }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+      return arena != other.arena;
+    }
+  private:
+    Arena* arena;
+    template<typename U>
+    friend class ArenaAllocator;
+  };
+  // A vector for use within the processing of one word.
+  template<typename T>
+  using ScratchVector = std::vector<T, ArenaAllocator<T>>;
+}
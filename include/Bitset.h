@@ -0,0 +1,81 @@
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace sca {
+  // A fixed-size set of small integers, such as phoneme or class IDs.
+  class Bitset {
+  public:
+    Bitset() : n(0) {}
+    explicit Bitset(size_t n, bool value = false) :
+        words((n + WORD_BITS - 1) / WORD_BITS, value ? ~(uint64_t) 0 : 0),
+        n(n) {
+      trim();
+    }
+    size_t size() const { return n; }
+    // Change the size of the set, dropping any elements that no longer fit.
+    void resize(size_t m) {
+      words.resize((m + WORD_BITS - 1) / WORD_BITS, 0);
+      n = m;
+      trim();
+    }
+    bool test(size_t i) const {
+      return (words[i / WORD_BITS] >> (i % WORD_BITS)) & 1;
+    }
+    void set(size_t i) {
+      words[i / WORD_BITS] |= (uint64_t) 1 << (i % WORD_BITS);
+    }
+    void reset(size_t i) {
+      words[i / WORD_BITS] &= ~((uint64_t) 1 << (i % WORD_BITS));
+    }
+    bool any() const {
+      for (uint64_t w : words) if (w != 0) return true;
+      return false;
+    }
+    bool intersects(const Bitset& other) const {
+      for (size_t i = 0; i < words.size(); ++i)
+        if ((words[i] & other.words[i]) != 0) return true;
+      return false;
+    }
+    Bitset& operator|=(const Bitset& other) {
+      for (size_t i = 0; i < words.size(); ++i) words[i] |= other.words[i];
+      return *this;
+    }
+    Bitset& operator&=(const Bitset& other) {
+      for (size_t i = 0; i < words.size(); ++i) words[i] &= other.words[i];
+      return *this;
+    }
+    // Remove all elements of `other` from this set.
+    Bitset& subtract(const Bitset& other) {
+      for (size_t i = 0; i < words.size(); ++i) words[i] &= ~other.words[i];
+      return *this;
+    }
+    bool operator==(const Bitset& other) const {
+      return n == other.n && words == other.words;
+    }
+    bool operator!=(const Bitset& other) const { return !(*this == other); }
+    // Call `cb` with each element of this set, in increasing order.
+    template<typename F>
+    void forEach(F&& cb) const {
+      for (size_t i = 0; i < words.size(); ++i) {
+        uint64_t w = words[i];
+        while (w != 0) {
+          cb(i * WORD_BITS + __builtin_ctzll(w));
+          w &= w - 1;
+        }
+      }
+    }
+  private:
+    static constexpr size_t WORD_BITS = CHAR_BIT * sizeof(uint64_t);
+    void trim() {
+      if (n % WORD_BITS != 0)
+        words.back() &= ((uint64_t) 1 << (n % WORD_BITS)) - 1;
+    }
+    std::vector<uint64_t> words;
+    size_t n;
+  };
+}
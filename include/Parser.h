@@ -33,13 +33,18 @@ namespace sca {
     std::optional<std::string> parseString();
     std::optional<size_t> parseNumber();
     std::optional<LuaCode> parseLuaCode();
+    bool atPureGamma();
     std::optional<std::pair<Feature, PhonemesByFeature>> parseFeature();
     std::optional<std::pair<std::string, std::vector<std::string>>>
     parseCharClass();
     std::optional<size_t> parseMatcherIndex();
     std::optional<CharMatcher::Constraint> parseMatcherConstraint();
+    std::optional<CharMatcher::Group> parseMatcherGroup();
     std::optional<CharMatcher> parseMatcher();
     bool parseEnvironment(SimpleRule& r);
+    std::optional<size_t> parseConditionClass();
+    std::optional<NativeCondition> parseNativeCondition();
+    bool parseNativeConditions(SimpleRule& r);
     std::optional<std::unique_ptr<SimpleRule>> parseSimpleRule();
     std::optional<std::unique_ptr<CompoundRule>> parseCompoundRule();
     std::optional<std::unique_ptr<Rule>> parseRule();
@@ -54,6 +59,8 @@ namespace sca {
     std::optional<std::pair<size_t, size_t>> parseRepeaterInner();
     std::optional<std::pair<size_t, size_t>> parseRepeater();
     std::optional<LuaCode> parseGlobalLuaDecl();
+    std::optional<Syllabifier> parseSyllables();
+    std::optional<std::string> parseCheckpoint();
     bool parseSoundChangeOptionChange();
     void printLineColumn();
   };
@@ -8,8 +8,11 @@
 
 #include <lua.hpp>
 
+#include "Arena.h"
+#include "Bitset.h"
 #include "PHash.h"
 #include "PUnique.h"
+#include "WString.h"
 #include "errors.h"
 
 namespace sca {
@@ -19,16 +22,32 @@ namespace sca {
   using MatchCapture = std::unordered_map<
     std::pair<size_t, size_t>,
     MatchResult,
-    PHash<size_t, size_t>>;
+    PHash<size_t, size_t>,
+    std::equal_to<std::pair<size_t, size_t>>,
+    ArenaAllocator<std::pair<const std::pair<size_t, size_t>, MatchResult>>>;
   struct PhonemeSpec {
     std::string name;
+    // The first class that this phoneme was put in, or -1 if none. This is
+    // the class shown for phonemes that aren't in the inventory, and the
+    // one that phonemes have to share to be considered equal.
     size_t charClass = -1;
+    // All of the classes that this phoneme is in.
+    Bitset classes;
     std::vector<size_t> featureValues;
+    // Index into the SCA's phoneme table, or -1 for phonemes that are not
+    // in the inventory (assigned by SCA::reversePhonemeMap).
+    size_t id = -1;
     size_t getFeatureValue(size_t f, const SCA& sca) const;
     void setFeatureValue(size_t f, size_t i, const SCA& sca);
-    bool hasClass(size_t cc) const { return charClass == cc; }
+    // Store the value of every feature explicitly, so that featureValues
+    // can be read as a plain array.
+    void fillFeatureValues(const SCA& sca);
+    bool hasClass(size_t cc) const {
+      return cc < classes.size() && classes.test(cc);
+    }
   };
   struct MChar;
+  struct SimpleRule;
   using MString = std::vector<MChar>;
   enum class Comparison {
     eq,
@@ -50,12 +69,39 @@ namespace sca {
         size_t otherInstance, const MatchCapture& mc, const SCA& sca) const;
       std::string toString(const SCA& sca) const;
       size_t evaluate(size_t i, const MatchCapture& mc, const SCA& sca) const;
+      // Does this constraint refer to another matcher?
+      bool isDependent() const;
+    };
+    // A parenthesised group of constraints, which matches if any of its
+    // options do (or, if `negated`, if none of them do). Each option is a
+    // list of constraints that must all match. Constraints in a group
+    // can't refer to other matchers.
+    struct Group {
+      std::vector<std::vector<Constraint>> options;
+      bool negated = false;
+      bool matches(const PhonemeSpec& ps, const SCA& sca) const;
+      std::string toString(const SCA& sca) const;
     };
     size_t charClass;
     size_t index;
     std::variant<std::vector<Constraint>, std::vector<const PhonemeSpec*>>
     constraints;
+    std::vector<Group> groups;
+    // For a matcher with constraints, the inventory phonemes (by ID) that
+    // belong to its class and satisfy all of its groups and the
+    // constraints that don't refer to other matchers. Empty until
+    // `compile` is called.
+    Bitset accepted;
+    bool compiled = false;
+    bool hasDependentConstraints = false;
     std::string toString(const SCA& sca) const;
+    // Does this matcher look at feature `f` (in which case it doesn't
+    // have to match a previously captured phoneme there)?
+    bool constrains(size_t f) const;
+    // Could this matcher match `ps` (ignoring any dependent constraints)?
+    bool acceptsStatically(const PhonemeSpec& ps, const SCA& sca) const;
+    // Fill in `accepted`; called once the phonemes have IDs.
+    void compile(const SCA& sca);
     bool hasConstraints() const {
       return std::holds_alternative<std::vector<Constraint>>(constraints);
     }
@@ -120,7 +166,50 @@ namespace sca {
   using MSRI = typename MString::reverse_iterator;
   using MSCI = typename MString::const_iterator;
   using MSRCI = typename MString::const_reverse_iterator;
-  using WString = std::vector<PUnique<const PhonemeSpec>>;
+  // Describes how a rule's environment pins it to the edges of a word.
+  struct Anchoring {
+    // If not -1, then α can only start this many characters after the
+    // start of the word (left) or end this many characters before the end
+    // of the word (right).
+    size_t left = -1, right = -1;
+    // The number of characters α always matches, or -1 if it can vary.
+    size_t width = -1;
+    bool isLeft() const { return left != -1 && right == -1; }
+    bool isRight() const { return left == -1 && right != -1; }
+    bool isFull() const { return left != -1 && right != -1; }
+  };
+  // A condition on a match that is checked without calling Lua. These are
+  // written as `$[...]` after the environment.
+  struct NativeCondition {
+    enum class Quantity {
+      wordLength, // `length`: the number of phonemes in the word
+      matchLength, // `match`: the number of phonemes that α matched
+      before, // `before`: the number of phonemes before the match
+      after, // `after`: the number of phonemes after the match
+      classCount, // `count(C)`: the number of phonemes in the word in C
+      // The rest need a `syllables` declaration (see syllables.h).
+      syllableCount, // `syllables`: the number of syllables in the word
+      // `syllablesBefore`, `syllablesAfter`: the number of syllables
+      // before or after the one that the match starts in
+      syllablesBefore,
+      syllablesAfter,
+      // `onset`, `nucleus`, `coda`: 1 if the first phoneme of the match
+      // is in that part of its syllable, otherwise 0
+      onset,
+      nucleus,
+      coda,
+      closed, // `closed`: 1 if the match starts in a syllable with a coda
+      boundary, // `boundary`: 1 if a syllable starts where the match does
+    };
+    Quantity q;
+    size_t charClass = -1;
+    Comparison c;
+    size_t value;
+    bool isSyllabic() const { return q >= Quantity::syllableCount; }
+    // Does the condition hold for a match from `mstart` to `mend` (counted
+    // from the start of the word)?
+    bool holds(const WString& word, size_t mstart, size_t mend) const;
+  };
   class Rule {
   public:
     virtual ~Rule() {};
@@ -131,6 +220,20 @@ namespace sca {
     virtual void verify(
       std::vector<Error>& errors, const SCA& sca, const SoundChange& sc) const
       = 0;
+    // Work out the anchoring of this rule and compile its matchers; called
+    // by SCA::reversePhonemeMap, after verify.
+    virtual void classify(const SCA& sca) = 0;
+    // Return the first position no earlier than `start` at which this
+    // rule could match in `word`, or -1 if there is none. The position is
+    // counted in the same way as the `start` argument to tryReplaceLTR or
+    // tryReplaceRTL.
+    virtual size_t nextCandidateLTR(const WString& word, size_t start) const
+      = 0;
+    virtual size_t nextCandidateRTL(const WString& word, size_t start) const
+      = 0;
+    // Return the simple rules that make up this rule, as a pointer to the
+    // first one and a count.
+    virtual std::pair<const SimpleRule*, size_t> getSimpleRules() const = 0;
     size_t line = -1, col = -1;
   };
   struct SimpleRule : public Rule {
@@ -142,13 +245,33 @@ namespace sca {
       std::vector<Error>& errors,
       const SCA& sca,
       const SoundChange& sc) const override;
+    void classify(const SCA& sca) override;
+    size_t nextCandidateLTR(const WString& word, size_t start) const override;
+    size_t nextCandidateRTL(const WString& word, size_t start) const override;
+    std::pair<const SimpleRule*, size_t> getSimpleRules() const override {
+      return {this, 1};
+    }
     MString alpha, omega;
     std::vector<std::pair<MString, MString>> envs;
     int gammaref = LUA_NOREF;
+    // Set by writing `pure` before Γ: its result depends only on W and M,
+    // so it is remembered for each word and match (see GammaCache).
+    bool pureGamma = false;
+    // Checked before Γ; all of them must hold.
+    std::vector<NativeCondition> conditions;
     bool inv;
+    Anchoring anchoring;
+    // The inventory phonemes that α starts (ends) with, if its first (last)
+    // one or two characters are literal phonemes; otherwise null.
+    const PhonemeSpec* leading[2] = {nullptr, nullptr};
+    const PhonemeSpec* trailing[2] = {nullptr, nullptr};
     bool setGamma(lua_State* luaState, const std::string_view& s);
   private:
-    bool evaluate(lua_State* luaState,
+    bool conditionsHold(
+      const WString& word, size_t mstart, size_t mend) const;
+    // Run Γ on a match. Only called when there is one, so that rules
+    // without Lua don't pay for a call per match.
+    bool evaluate(const SCA& sca,
       const WString& word, size_t mstart, size_t mend) const;
   };
   struct CompoundRule : public Rule {
@@ -160,6 +283,44 @@ namespace sca {
       std::vector<Error>& errors,
       const SCA& sca,
       const SoundChange& sc) const override;
+    void classify(const SCA& sca) override;
+    size_t nextCandidateLTR(const WString& word, size_t start) const override;
+    size_t nextCandidateRTL(const WString& word, size_t start) const override;
+    std::pair<const SimpleRule*, size_t> getSimpleRules() const override {
+      return {components.data(), components.size()};
+    }
     std::vector<SimpleRule> components;
   };
+  // The results of pure Γs, keyed by the rule, the phonemes of the word
+  // and the span of the match. Since the whole word is part of the key,
+  // a result is found again only while the word is unchanged (or for
+  // another word with the same phonemes); words that contain phonemes
+  // outside of the inventory aren't cached. The cache is emptied when it
+  // gets too large.
+  class GammaCache {
+  public:
+    // Look up a result. This also remembers the key, for the next call to
+    // insert.
+    std::optional<bool> find(const SimpleRule* rule,
+      const WString& word, size_t mstart, size_t mend);
+    void insert(bool result);
+    void clear() { results.clear(); }
+  private:
+    static constexpr size_t MAX_ENTRIES = 1 << 16;
+    struct Key {
+      const SimpleRule* rule;
+      size_t mstart, mend;
+      std::vector<size_t> word;
+      bool operator==(const Key& other) const {
+        return rule == other.rule && mstart == other.mstart &&
+          mend == other.mend && word == other.word;
+      }
+    };
+    struct KeyHash {
+      size_t operator()(const Key& k) const;
+    };
+    std::unordered_map<Key, bool, KeyHash> results;
+    Key last;
+    bool lastCacheable = false;
+  };
 }
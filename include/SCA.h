@@ -5,6 +5,7 @@
 
 #include <deque>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -13,10 +14,12 @@
 
 #include <lua.hpp>
 
+#include "Bitset.h"
 #include "PHash.h"
 #include "Rule.h"
 #include "Token.h"
 #include "errors.h"
+#include "syllables.h"
 
 namespace sca {
   enum class EvaluationOrder {
@@ -47,11 +50,64 @@ namespace sca {
     EvaluationOrder eo = EvaluationOrder::ltr;
     Behaviour beh = Behaviour::once;
   };
+  // Limits on the work that SCA::applySoundChanges may do on one word.
+  // When one is reached, the word is left as it is at that point and an
+  // error is reported. 0 means no limit.
+  struct WordLimits {
+    // How many replacements one sound change may make in a word
+    size_t replacements = 0;
+    // How many phonemes longer than its input a word may get
+    size_t growth = 0;
+    // How many steps matching a pattern at one position may take
+    size_t matchSteps = 100000;
+    // How many Lua instructions one evaluation of a Γ may run
+    size_t luaInstructions = 0;
+  };
+  enum class Limit {
+    none,
+    replacements,
+    growth,
+    matchSteps,
+    matchDepth, // see MAX_MATCH_DEPTH
+    luaInstructions,
+  };
+  // The limit that has stopped the processing of the current word, if
+  // any. Set by whatever reaches the limit, and reported and cleared by
+  // SCA::applySoundChanges.
+  extern thread_local Limit limitReached;
+  // How many more replacements the sound change being applied may make, or
+  // -1 if there is no limit. A rule that matches when this is 0 sets
+  // limitReached instead of replacing anything.
+  extern thread_local size_t replacementsLeft;
+  // The most phonemes that the word may have after a replacement by the
+  // sound change being applied, or -1 if there is no limit. A rule whose
+  // replacement would make the word longer than this sets limitReached
+  // instead of replacing anything.
+  extern thread_local size_t maxWordSize;
   struct SoundChange {
     std::unique_ptr<Rule> rule;
     SoundChangeOptions opt;
-    std::unordered_set<std::string> poses;
-    bool apply(const SCA& sca, WString& st, const std::string& pos) const;
+    // Interned part-of-speech IDs (see SCA::internPOS). Empty if this
+    // sound change applies to all parts of speech.
+    std::vector<size_t> poses;
+    // Apply this sound change to `st`, stopping before it would get longer
+    // than `maxSize` phonemes. Returns whether it matched anywhere.
+    bool apply(const SCA& sca, WString& st, size_t maxSize = -1) const;
+  };
+  // The most sound changes that SCA::fuseRules will put in one pass.
+  constexpr size_t MAX_FUSED = 8;
+  // A point in a script at which the word is recorded (see
+  // SCA::applySoundChanges), declared with `checkpoint <name>;`.
+  struct Checkpoint {
+    std::string name;
+    // The number of sound changes before it
+    size_t position;
+    size_t line, col;
+  };
+  // A sound change that SCA::eliminateDeadRules found can never apply.
+  struct DeadRule {
+    size_t index; // into the list of sound changes
+    std::string reason;
   };
   class SCA {
   public:
@@ -91,10 +147,59 @@ namespace sca {
       return (0 <= id && id < features.size())
         ? &(features[id]) : nullptr;
     }
-    void insertSoundChange(SoundChange&& sc) {
-      rules.push_back(std::move(sc));
+    void insertSoundChange(SoundChange&& sc);
+    // Add a checkpoint after the sound changes inserted so far.
+    [[nodiscard]] Error insertCheckpoint(
+      std::string&& name, size_t line, size_t col);
+    size_t getCheckpointCount() const { return checkpoints.size(); }
+    const Checkpoint& getCheckpoint(size_t i) const { return checkpoints[i]; }
+    // Returns -1 if there is no such checkpoint.
+    size_t getCheckpointByName(const std::string& name) const;
+    // Is there a checkpoint between sound changes `a` and `b` (a < b)?
+    bool hasCheckpointBetween(size_t a, size_t b) const;
+    [[nodiscard]] Error setSyllabifier(Syllabifier&& syl);
+    // The script's `syllables` declaration, or null if it has none.
+    const Syllabifier* getSyllabifier() const {
+      return syllabifier.has_value() ? &*syllabifier : nullptr;
+    }
+    const SoundChange& getSoundChange(size_t i) const { return rules[i]; }
+    size_t getSoundChangeCount() const { return rules.size(); }
+    // The number of sound changes before the last feature, class,
+    // syllables or global Lua code declaration in the script.
+    size_t getLastDeclaration() const { return lastDeclaration; }
+    size_t internPOS(const std::string& name);
+    // Returns -1 if no sound change mentions this part of speech.
+    size_t getPOSByName(const std::string& name) const {
+      auto it = posesByName.find(name);
+      return (it != posesByName.end()) ? it->second : -1;
     }
+    // Assign IDs to the phonemes in the inventory, build the reverse
+    // phoneme map and classify the sound changes (see Rule::classify).
+    // Call after parsing and verifying.
     void reversePhonemeMap();
+    // Return the phoneme for a literal in ω that isn't in the inventory
+    // (created by reversePhonemeMap), or null if there is none.
+    const PhonemeSpec* getStrayPhoneme(const std::string& name) const {
+      auto it = strayPhonemes.find(name);
+      return (it != strayPhonemes.end()) ? &it->second : nullptr;
+    }
+    const PhonemeSpec& getPhonemeByID(size_t id) const {
+      return *phonemesByID[id];
+    }
+    size_t getPhonemeCount() const { return phonemesByID.size(); }
+    size_t getClassCount() const { return charClasses.size(); }
+    size_t getFeatureCount() const { return features.size(); }
+    // Work out which phonemes might occur in a word before each sound
+    // change, and drop any sound changes that can never apply from the
+    // rule lists. Call after reversePhonemeMap. See reachability.cpp.
+    void eliminateDeadRules(std::vector<DeadRule>& dead);
+    // The phonemes that might occur before sound change `i` (or after all
+    // of them, for `i` equal to the number of sound changes).
+    const Bitset& getReachable(size_t i) const { return reachable[i]; }
+    // Group adjacent sound changes that can't affect each other into
+    // passes that SCA::apply runs in a single scan of the word. Call after
+    // eliminateDeadRules. See reachability.cpp.
+    void fuseRules();
     auto getPhonemesBySpec(const PhonemeSpec& ps) const {
       return phonemesReverse.equal_range(ps);
     }
@@ -109,27 +214,91 @@ namespace sca {
     auto forEachPhoneme(F&& cb) const {
       for (const auto& p : phonemes) cb(p.second);
     }
-    void verify(std::vector<Error>& errors) const;
+    void verify(std::vector<Error>& errors);
+    // Split a word into phonemes.
+    WString tokenize(const std::string_view& st) const;
+    // Apply the sound changes for the part of speech `pos` to `ws`. If
+    // `errors` is not null, then problems found along the way (such as
+    // reaching one of the limits) are added to it. If `stages` is not
+    // null, then it is set to the word as it was at each checkpoint.
+    void applySoundChanges(
+      WString& ws, const std::string& pos, bool verbose = false,
+      std::vector<Error>* errors = nullptr,
+      std::vector<std::string>* stages = nullptr) const;
+    // Apply only the sound changes with indices from `first` up to (but not
+    // including) `last` to `ws`, which had `inputSize` phonemes before any
+    // sound change was applied to it (for the growth limit). Returns false
+    // if a limit was reached, in which case the later sound changes
+    // shouldn't be applied either.
+    bool applySoundChangeRange(
+      WString& ws, const std::string& pos, size_t first, size_t last,
+      size_t inputSize, bool verbose = false,
+      std::vector<Error>* errors = nullptr) const;
+    // Tokenize, apply the sound changes and convert back to a string.
     std::string apply(
       const std::string_view& st,
       const std::string& pos,
-      bool verbose = false) const;
+      bool verbose = false,
+      std::vector<Error>* errors = nullptr,
+      std::vector<std::string>* stages = nullptr) const;
     void addGlobalLuaCode(const LuaCode& lc);
+    // Whether this script has any Lua code (global code or Γs).
+    bool usesLua() const;
     std::string executeGlobalLuaCode();
     std::string wStringToString(const WString& ws) const;
+    // The Lua state, or null if this script has no Lua code. It is only
+    // created once the parser sees some (see requireLuaState).
     lua_State* getLuaState() const { return luaState.get(); }
+    lua_State* requireLuaState();
+    GammaCache& getGammaCache() const { return gammaCache; }
+    const WordLimits& getLimits() const { return limits; }
+    void setLimits(const WordLimits& l);
   private:
+    bool applyRange(
+      WString& ws, const std::string& pos, size_t first, size_t last,
+      size_t inputSize, bool verbose, std::vector<Error>* errors,
+      std::vector<std::string>* stages) const;
+    const SoundChange* applyFused(
+      const size_t* ris, size_t n, WString& st) const;
+    void reportLimit(
+      const SoundChange& sc, const WString& st,
+      std::vector<Error>* errors) const;
     std::vector<CharClass> charClasses;
     std::vector<Feature> features;
     std::unordered_map<std::string, size_t> featuresByName;
     std::unordered_map<std::string, size_t> classesByName;
     std::unordered_map<std::string, PhonemeSpec> phonemes;
+    std::vector<const PhonemeSpec*> phonemesByID;
+    std::unordered_map<std::string, PhonemeSpec> strayPhonemes;
+    // The length in bytes of the longest phoneme name, or -1 before
+    // reversePhonemeMap is called.
+    size_t longestPhonemeName = -1;
+    std::vector<Bitset> reachable;
     std::vector<SoundChange> rules;
+    std::vector<Checkpoint> checkpoints;
+    size_t lastDeclaration = 0;
+    std::vector<std::string> posNames;
+    std::unordered_map<std::string, size_t> posesByName;
+    // Indices into `rules` of the sound changes to run on a word with
+    // a given part of speech, in order. `unrestrictedRules` is used for
+    // words whose part of speech is not mentioned by any sound change.
+    std::vector<std::vector<size_t>> rulesByPOS;
+    std::vector<size_t> unrestrictedRules;
+    // For each of the lists above, the (exclusive) end index of each pass
+    // of fused sound changes. Empty until fuseRules is called.
+    std::vector<std::vector<size_t>> passesByPOS;
+    std::vector<size_t> unrestrictedPasses;
     std::unordered_multimap<
       PhonemeSpec, std::string, PSHash, PSEqual> phonemesReverse;
     mutable std::unique_ptr<lua_State, decltype(&lua_close)>
       luaState;
     std::string globalLuaCode;
+    mutable GammaCache gammaCache;
+    WordLimits limits;
+    std::optional<Syllabifier> syllabifier;
+    // Whether any sound change looks at syllables, in which case
+    // applySoundChanges keeps track of them (set by reversePhonemeMap).
+    bool tracksSyllables = false;
   };
   void splitIntoPhonemes(
     const SCA& sca, const std::string_view s,
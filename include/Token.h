@@ -15,6 +15,7 @@ namespace sca {
     lsb,
     rsb,
     dlb,
+    dlsb,
     lcb,
     rcb,
     comma,
@@ -40,6 +41,8 @@ namespace sca {
     kwOrdered,
     kwExecuteOnce,
     kwSetOptions,
+    kwSyllables,
+    kwCheckpoint,
   };
   struct LuaCode {
     std::string code;
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <iterator>
+#include <new>
+#include <utility>
+
+#include "Arena.h"
+#include "PUnique.h"
+
+namespace sca {
+  struct PhonemeSpec;
+  // A word, as an array of phonemes.
+  //
+  // Words of up to INLINE_CAPACITY phonemes are stored in the object
+  // itself; longer ones are allocated with an ArenaAllocator, so they come
+  // from the scratch arena when created inside an ArenaScope.
+  //
+  // The phonemes don't have to start at the beginning of the buffer.
+  // Replacing part of the word (as sound changes do) moves whichever side
+  // of the replaced part is shorter, so edits near either end of a word
+  // are cheap, and the room that this leaves at the start of the buffer is
+  // reused by later edits.
+  //
+  // A sound change that scans the word and keeps going after each
+  // replacement edits it near the same place over and over. For those, the
+  // free room can instead be kept as a gap in the middle of the word, which
+  // follows the scan (see moveGap). Indexing skips over the gap, but
+  // begin() and end() don't, so the word can't be iterated over as a whole
+  // while it's open; use at() and endAt() to get the parts on either side.
+  class WString {
+  public:
+    using value_type = PUnique<const PhonemeSpec>;
+    using iterator = value_type*;
+    using const_iterator = const value_type*;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    static constexpr size_t INLINE_CAPACITY = 32;
+    WString() : buf(inlineBuffer()) {}
+    WString(WString&& other) noexcept;
+    WString& operator=(WString&& other) noexcept;
+    WString(const WString&) = delete;
+    WString& operator=(const WString&) = delete;
+    ~WString();
+    size_t size() const { return n; }
+    bool empty() const { return n == 0; }
+    value_type* data() { return buf + head; }
+    const value_type* data() const { return buf + head; }
+    value_type& operator[](size_t i) { return buf[head + physical(i)]; }
+    const value_type& operator[](size_t i) const {
+      return buf[head + physical(i)];
+    }
+    // Where phoneme `i` starts, and where the first `i` phonemes end. These
+    // are only different when the gap is at `i`.
+    iterator at(size_t i) { return buf + head + physical(i); }
+    iterator endAt(size_t i) {
+      return buf + head + i + (i > gapAt ? gapLen : 0);
+    }
+    iterator begin() { return data(); }
+    iterator end() { return data() + n + gapLen; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + n + gapLen; }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const {
+      return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const {
+      return const_reverse_iterator(begin());
+    }
+    // The following four can't be used while the gap is open.
+    void push_back(value_type&& p) {
+      if (head + n == cap) makeRoomAtEnd(1);
+      new (buf + head + n) value_type(std::move(p));
+      ++n;
+    }
+    void reserve(size_t m) {
+      if (head + m > cap) makeRoomAtEnd(m - n);
+    }
+    void resize(size_t m);
+    void clear() { resize(0); }
+    // Replace the elements from `b` to `e` with the ones from `first` to
+    // `last`, which are moved from. While the gap is open, it's left just
+    // after the new elements.
+    template<typename It>
+    void replace(size_t b, size_t e, It first, It last) {
+      size_t k = (size_t) (last - first);
+      value_type* p = keepGap ? fillGap(b, e, k) : makeRoom(b, e, k);
+      for (; first != last; ++first, ++p) new (p) value_type(std::move(*first));
+    }
+    // Open the gap if it isn't already, and move it to just before
+    // phoneme `i`. This takes time proportional to how far it moves.
+    void moveGap(size_t i);
+    // Close the gap, so that the phonemes are next to each other again.
+    void closeGap();
+  private:
+    value_type* inlineBuffer() {
+      return reinterpret_cast<value_type*>(storage);
+    }
+    bool isInline() const {
+      return buf == reinterpret_cast<const value_type*>(storage);
+    }
+    size_t physical(size_t i) const { return i + (i >= gapAt ? gapLen : 0); }
+    void destroy(size_t b, size_t e);
+    // Make sure that there's room for `k` more elements after the end.
+    void makeRoomAtEnd(size_t k);
+    // Destroy the elements from `b` to `e` and make room for `k` elements
+    // in their place. Returns a pointer to the first one.
+    value_type* makeRoom(size_t b, size_t e, size_t k);
+    // The same, while the gap is open: the room comes from the gap.
+    value_type* fillGap(size_t b, size_t e, size_t k);
+    // Make the gap at least `k` elements long.
+    void growGap(size_t k);
+    // Move the elements to a new buffer of `newCap` elements, starting at
+    // `newHead`. The `removed` elements starting at `at` (which must have
+    // been destroyed already) are replaced with room for `gap` elements.
+    void reallocate(
+      size_t newCap, size_t newHead, size_t at, size_t removed, size_t gap);
+    value_type* buf;
+    size_t cap = INLINE_CAPACITY, head = 0, n = 0;
+    ArenaAllocator<value_type> alloc;
+    alignas(value_type) unsigned char
+      storage[INLINE_CAPACITY * sizeof(value_type)];
+    // The gap is before phoneme `gapAt`. It can be empty while open.
+    // (These come last because moving `storage` further into the object
+    // made the 712711.zt benchmark measurably slower.)
+    size_t gapAt = 0, gapLen = 0;
+    bool keepGap = false;
+  };
+  template<typename It>
+  void replaceSubrange(WString& v1, size_t b1, size_t e1, It b2, It e2) {
+    v1.replace(b1, e1, b2, e2);
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SCA.h"
+
+namespace sca {
+  // A script that can apply sound changes to many words on several threads
+  // at once. This is for programs that use ztš as a library, such as the
+  // Lua and Python modules.
+  //
+  // The sound changes themselves don't modify the SCA, so one copy can be
+  // shared between threads, but each Lua state can only be used by one
+  // thread at a time. A script that uses Lua is therefore loaded again for
+  // each extra thread, which runs its global Lua code again.
+  class ScriptPool {
+  public:
+    // Load a script from its source, as loadScript does. Returns null if
+    // it couldn't be loaded.
+    static std::unique_ptr<ScriptPool> load(std::string source);
+    const SCA& getSCA() const { return *scas[0]; }
+    void setLimits(const WordLimits& l);
+    // Apply the sound changes to one word on the calling thread. For a
+    // script that uses Lua, this waits for any other call to apply or
+    // applyBatch to finish.
+    std::string apply(
+      const std::string_view& word, const std::string& pos,
+      std::vector<Error>* errors = nullptr) const;
+    // Apply the sound changes to each word in `words`, using up to
+    // `nThreads` threads (or one for each CPU if it is 0). `poses` is
+    // either empty or holds the part of speech of each word. If `errors`
+    // is not null, it is resized to hold the errors for each word.
+    void applyBatch(
+      const std::vector<std::string>& words,
+      const std::vector<std::string>& poses,
+      std::vector<std::string>& out,
+      std::vector<std::vector<Error>>* errors = nullptr,
+      size_t nThreads = 0);
+  private:
+    ScriptPool() = default;
+    // Try to make sure that `n` threads can apply sound changes at once,
+    // and return how many can (fewer only if loading another copy of a
+    // script that uses Lua failed).
+    size_t reserveCopies(size_t n);
+    std::string source;
+    WordLimits limits;
+    bool usesLua;
+    std::vector<std::unique_ptr<SCA>> scas;
+    // Held while a Lua state is in use (and while applyBatch runs, since
+    // it uses every copy of the script).
+    mutable std::mutex lock;
+  };
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "SCA.h"
+
+namespace sca {
+  // Two versions of a script, applied to each word side by side in order
+  // to find the words that the changes between them affect.
+  //
+  // The sound changes at the start of both scripts that are known to
+  // behave the same are applied to each word only once, and the result is
+  // then copied for the rest of each script. A sound change counts as
+  // shared if the source text of both scripts is the same up to the start
+  // of the next one, all declarations come before that point in both
+  // scripts and the phoneme inventories are the same. Scripts that use Lua
+  // share nothing, since a Γ might change the state of its Lua
+  // interpreter.
+  class ScriptDiff {
+  public:
+    ScriptDiff(
+      std::unique_ptr<SCA>&& oldSCA, const std::string& oldSource,
+      std::unique_ptr<SCA>&& newSCA, const std::string& newSource);
+    const SCA& getOld() const { return *oldSCA; }
+    const SCA& getNew() const { return *newSCA; }
+    // The number of sound changes at the start that are applied once
+    size_t getSharedCount() const { return shared; }
+    // Apply both scripts to a word. Returns whether the outputs differ.
+    bool apply(
+      const std::string_view& st, const std::string& pos,
+      std::string& oldOut, std::string& newOut, bool verbose = false,
+      std::vector<Error>* errors = nullptr) const;
+  private:
+    // Copy a word made of the old script's phonemes into one made of the
+    // new one's.
+    WString fork(const WString& ws) const;
+    std::unique_ptr<SCA> oldSCA, newSCA;
+    size_t shared = 0;
+  };
+}
@@ -10,7 +10,7 @@ namespace sca {
     featureExists,
     noSuchClass,
     classExists,
-    phonemeAlreadyHasClass,
+    phonemeAlreadyHasClass, // no longer reported
     noSuchPhoneme,
     explicitLabelZero,
     mixedMatchers,
@@ -24,6 +24,12 @@ namespace sca {
     nonSingleCharInOmega,
     orderedConstraintUnorderedFeature,
     undefinedDependentConstraint,
+    dependentConstraintInGroup,
+    groupInOmega,
+    wordLimitReached,
+    syllablesExist,
+    noSyllables,
+    checkpointExists,
   };
   struct Error {
     ErrorCode ec;
@@ -51,13 +51,13 @@ namespace sca {
   auto reverseIterator(It it) {
     return IRev<It>::get(it);
   }
-  template<typename T>
+  template<typename V, typename It>
   static void replaceSubrange(
-      std::vector<T>& v1,
+      V& v1,
       size_t b1,
       size_t e1,
-      typename std::vector<T>::iterator b2,
-      typename std::vector<T>::iterator e2) {
+      It b2,
+      It e2) {
     size_t size1 = (size_t) (e1 - b1);
     size_t size2 = (size_t) (e2 - b2);
     size_t oldSize = v1.size();
@@ -75,13 +75,13 @@ namespace sca {
     }
     std::move(b2, e2, v1.begin() + b1);
   }
-  template<typename T>
+  template<typename V, typename It>
   static void replaceSubrange(
-      std::vector<T>& v1,
-      typename std::vector<T>::iterator b1,
-      typename std::vector<T>::iterator e1,
-      typename std::vector<T>::iterator b2,
-      typename std::vector<T>::iterator e2) {
+      V& v1,
+      typename V::iterator b1,
+      typename V::iterator e1,
+      It b2,
+      It e2) {
     replaceSubrange(v1, b1 - v1.begin(), e1 - v1.begin(), b2, e2);
   }
 }
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <iosfwd>
+#include <memory>
+#include <vector>
+
+#include "SCA.h"
+
+namespace sca {
+  // Parse a script and get it ready to apply words to: verify it, prepare
+  // its phonemes and sound changes, and run its global Lua code. Any
+  // problems are printed to stderr, in which case null is returned. If
+  // `dead` is not null, the sound changes that can never apply are added
+  // to it.
+  std::unique_ptr<SCA> loadScript(
+    std::istream& in, std::vector<DeadRule>* dead = nullptr);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <lua.hpp>
+
+/*
+  ztš is written against the Lua 5.3 API, but it can also be built with
+  LuaJIT (see SCA_USE_LUAJIT in CMakeLists.txt), which implements 5.1
+  plus a few 5.2 functions. This fills in what's missing.
+*/
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#if LUA_VERSION_NUM < 503
+namespace sca::lua {
+  inline int absIndex(lua_State* l, int index) {
+    return (index < 0 && index > LUA_REGISTRYINDEX) ?
+      lua_gettop(l) + index + 1 : index;
+  }
+}
+inline int lua_geti(lua_State* l, int index, lua_Integer i) {
+  index = sca::lua::absIndex(l, index);
+  lua_pushinteger(l, i);
+  lua_gettable(l, index);
+  return lua_type(l, -1);
+}
+inline void lua_seti(lua_State* l, int index, lua_Integer i) {
+  index = sca::lua::absIndex(l, index);
+  lua_pushinteger(l, i);
+  lua_insert(l, -2);
+  lua_settable(l, index);
+}
+#endif
+
+#if LUA_VERSION_NUM < 502
+#define lua_rawlen lua_objlen
+#endif
+
+// LuaJIT has these, but stock Lua 5.1 doesn't.
+#if LUA_VERSION_NUM < 502 && !defined(SCA_LUAJIT)
+#define luaL_loadbufferx(l, buf, size, name, mode) \
+  luaL_loadbuffer(l, buf, size, name)
+#define luaL_setfuncs(l, funcs, nup) luaL_register(l, nullptr, funcs)
+#endif
@@ -14,15 +14,21 @@ namespace sca {
     MatchResult(const PhonemeSpec* ps, bool owned, size_t index) :
       ps(ps), owned(owned), index(index) {}
     //MatchResult(const PhonemeSpec* ps, bool owned) : ps(ps), owned(owned) {}
+    // Captured phonemes usually point into the word, so only copy the
+    // phoneme itself if we own it.
     MatchResult(const MatchResult& mr) :
-      ps(new PhonemeSpec(*mr.ps)), owned(true) {}
-    MatchResult(MatchResult&& mr) : ps(mr.ps), owned(mr.owned) {
+      ps(mr.owned ? new PhonemeSpec(*mr.ps) : mr.ps), owned(mr.owned),
+      index(mr.index) {}
+    MatchResult(MatchResult&& mr) :
+        ps(mr.ps), owned(mr.owned), index(mr.index) {
       mr.ps = nullptr;
       mr.owned = false;
     }
     MatchResult& operator=(MatchResult&& mr) {
+      if (owned) delete ps;
       ps = mr.ps;
       owned = mr.owned;
+      index = mr.index;
       mr.ps = nullptr;
       mr.owned = false;
       return *this;
@@ -34,8 +40,22 @@ namespace sca {
     bool owned;
     size_t index;
   };
+  // The most levels that the matcher may recurse by (once for each copy
+  // of a repetition of anything but a single character) before it gives
+  // up and sets limitReached to Limit::matchDepth. Unlike the other
+  // limits, this one guards against running out of stack, so it is fixed.
+  constexpr size_t MAX_MATCH_DEPTH = 10000;
   bool charsMatch(
     const SCA& sca, const MChar& fr, const PhonemeSpec& fi, MatchCapture& mc);
   PUnique<const PhonemeSpec> applyOmega(
     const SCA& sca, const MChar& old, const MatchCapture& mc);
+  // Match `pattern` against `word` starting at `start` (counted from the end
+  // in the RTL version) and return the length of the match. These expose
+  // the matcher used by SimpleRule::tryReplace* (defined in Rule.cpp).
+  std::optional<size_t> matchPatternLTR(
+    const SCA& sca, WString& word, size_t start, const MString& pattern,
+    MatchCapture& mc);
+  std::optional<size_t> matchPatternRTL(
+    const SCA& sca, WString& word, size_t start, const MString& pattern,
+    MatchCapture& mc);
 }
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Bitset.h"
+#include "SCA.h"
+
+namespace sca {
+  // Several scripts applied one after another to each word, as if the
+  // output of each one were given to the next.
+  //
+  // Rather than rendering the word as text and tokenizing it again between
+  // two scripts, the phonemes are handed over directly when that gives the
+  // same result: that is, when every phoneme is in the first script's
+  // inventory, the second script has a phoneme with the same name, and
+  // none of these names (except the last one in the word) could run into
+  // the next one when tokenizing, because it's the start of a longer name
+  // in the second script. Other words are converted through text.
+  class Pipeline {
+  public:
+    void addStage(std::unique_ptr<SCA>&& sca);
+    size_t getStageCount() const { return stages.size(); }
+    SCA& getStage(size_t i) { return *stages[i].sca; }
+    const SCA& getStage(size_t i) const { return *stages[i].sca; }
+    // The checkpoints of all of the scripts are numbered in order. Returns
+    // -1 if none of them has this name; if more than one does, the first
+    // is returned.
+    size_t getCheckpointByName(const std::string& name) const;
+    // As SCA::apply, for each script in turn.
+    std::string apply(
+      const std::string_view& st,
+      const std::string& pos,
+      bool verbose = false,
+      std::vector<Error>* errors = nullptr,
+      std::vector<std::string>* checkpoints = nullptr) const;
+  private:
+    struct Stage {
+      std::unique_ptr<SCA> sca;
+      // For each phoneme ID in the previous script, the phoneme with the
+      // same name in this one, or null if there is none
+      std::vector<const PhonemeSpec*> fromPrevious;
+      // The previous script's phoneme IDs whose names start a longer
+      // phoneme name in this script
+      Bitset prefixes;
+    };
+    // Convert `ws` from the phonemes of stage `i - 1` to those of stage `i`.
+    void handOver(size_t i, WString& ws) const;
+    std::vector<Stage> stages;
+  };
+}
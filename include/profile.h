@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iosfwd>
+#include <vector>
+
+namespace sca {
+  class SCA;
+  // Counters for one sound change.
+  struct RuleProfile {
+    uint64_t ns = 0; // time spent applying the sound change
+    uint64_t candidates = 0; // positions at which it was tried
+    uint64_t alphaMatches = 0; // matches of α that were tried
+    uint64_t envRejections = 0; // ... but the environment didn't
+    uint64_t gammaEvaluations = 0;
+    uint64_t gammaNs = 0; // time spent evaluating Γ
+    uint64_t gammaCacheHits = 0; // pure Γs that didn't have to be evaluated
+    uint64_t replacements = 0;
+    RuleProfile& operator+=(const RuleProfile& other);
+  };
+  // Counters for each sound change in a script, in the same order as
+  // SCA::getSoundChange.
+  struct Profile {
+    Profile(const SCA& sca);
+    std::vector<RuleProfile> rules;
+    uint64_t words = 0; // words passed to SCA::apply
+    uint64_t allocations = 0; // heap allocations made by SCA::apply
+    Profile& operator+=(const Profile& other);
+  };
+  // The number of heap allocations made on this thread. The library
+  // doesn't maintain this itself: a program that wants allocations to be
+  // reported in profiles should replace the global operator new with one
+  // that increments it (as main.cpp does).
+  extern thread_local uint64_t allocationCount;
+  // The profile that SCA::applySoundChanges records into on this thread,
+  // or null if profiling is off. Each thread should have its own profile;
+  // merge them afterwards.
+  extern thread_local Profile* activeProfile;
+  // The counters for the sound change that is being applied on this
+  // thread, or null if profiling is off.
+  extern thread_local RuleProfile* currentRuleProfile;
+  using ProfileClock = std::chrono::steady_clock;
+  inline uint64_t nsSince(ProfileClock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      ProfileClock::now() - start).count();
+  }
+  // Print a table of the sound changes, slowest first.
+  void printProfile(std::ostream& out, const SCA& sca, const Profile& p);
+  void writeProfileJSON(std::ostream& out, const SCA& sca, const Profile& p);
+}
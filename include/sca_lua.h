@@ -1,6 +1,6 @@
 #pragma once
 
-#include <lua.hpp>
+#include "lua_compat.h"
 
 namespace sca {
   class SCA;
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "Rule.h"
+
+namespace sca {
+  // Return the first position `i` in [begin, end) such that word[i] is the
+  // inventory phoneme `a` and, if `b` is not null, word[i + 1] is `b`. Return
+  // -1 if there is no such position.
+  //
+  // This compares pointers, which is valid because every phoneme in a word
+  // that is equal to an inventory phoneme points to that phoneme. It uses
+  // SIMD instructions when the CPU supports them. If the word has a gap,
+  // then the elements that it looks at must all be on the same side of it.
+  size_t findLiteral(
+    const WString& word, size_t begin, size_t end,
+    const PhonemeSpec* a, const PhonemeSpec* b);
+  // The same as findLiteral, but returns the last such position.
+  size_t findLiteralReverse(
+    const WString& word, size_t begin, size_t end,
+    const PhonemeSpec* a, const PhonemeSpec* b);
+}
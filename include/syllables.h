@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "Arena.h"
+#include "Bitset.h"
+#include "Rule.h"
+#include "WString.h"
+
+namespace sca {
+  class SCA;
+  // How a script splits words into syllables, as declared by its
+  // `syllables` block. Every nucleus is one phoneme and makes its own
+  // syllable. The phonemes between two nuclei are split so that the second
+  // syllable gets the longest allowed onset that leaves an allowed coda to
+  // the first one; phonemes before the first nucleus are all onset, and
+  // those after the last one are all coda. With no `onset` (`coda`)
+  // patterns, any onset (coda) is allowed.
+  struct Syllabifier {
+    // Single characters; a phoneme is a nucleus if it matches any of them.
+    MString nuclei;
+    std::vector<MString> onsets, codas;
+    // The inventory phonemes (by ID) that are nuclei. Empty until
+    // `compile` is called.
+    Bitset nucleusIDs;
+    bool compiled = false;
+    // Called once the phonemes have IDs.
+    void compile(const SCA& sca);
+    bool isNucleus(const SCA& sca, const PhonemeSpec& ps) const;
+    // Return how many of the phonemes from `b` to `e` in `word`, which lie
+    // between two nuclei, go to the onset of the second syllable.
+    size_t splitCluster(
+      const SCA& sca, const WString& word, size_t b, size_t e) const;
+  };
+  enum class SyllableRole : uint8_t {
+    onset,
+    nucleus,
+    coda,
+  };
+  // The syllables of a word that sound changes are being applied to. After
+  // each replacement, SimpleRule::tryReplace* calls `update`, which only
+  // redoes the phonemes between the nuclei on either side of the
+  // replacement; everything else is a lookup.
+  class Syllables {
+  public:
+    Syllables(const SCA& sca, const Syllabifier& syl, const WString& word);
+    // The phonemes from `b` to `e` have been replaced with `k` others.
+    void update(const WString& word, size_t b, size_t e, size_t k);
+    size_t count() const { return nSyllables; }
+    // The syllable that phoneme `i` is in, counted from 0.
+    size_t syllableAt(size_t i) const { return syllables[i]; }
+    SyllableRole roleAt(size_t i) const { return roles[i]; }
+    // Does a syllable start at phoneme `i`? The end of the word counts.
+    bool startsSyllable(size_t i) const {
+      return i == 0 || i >= roles.size() ||
+        (roles[i] != SyllableRole::coda &&
+          roles[i - 1] != SyllableRole::onset);
+    }
+    // Does the syllable that phoneme `i` is in end with a coda?
+    bool isClosed(size_t i) const;
+  private:
+    void reset(const WString& word);
+    // Work out the roles of the phonemes from `b` to `e`, which must
+    // already be marked if they are nuclei, and of the phonemes around
+    // them up to the nearest nuclei; then renumber the syllables from
+    // there on.
+    void syllabify(const WString& word, size_t b, size_t e);
+    const SCA& sca;
+    const Syllabifier& syl;
+    ScratchVector<SyllableRole> roles;
+    ScratchVector<size_t> syllables;
+    size_t nSyllables = 0;
+  };
+  // The syllables of the word that SCA::applySoundChanges is working on in
+  // this thread, or null if the script doesn't look at them.
+  extern thread_local Syllables* currentSyllables;
+}
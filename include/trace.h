@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <iosfwd>
+#include <mutex>
+#include <vector>
+
+namespace sca {
+  class Rule;
+  // Writes events in the Chrome Trace Event format, which can be viewed
+  // in Perfetto or chrome://tracing.
+  //
+  // Each thread buffers its own events and writes them out in chunks.
+  // Threads other than the one that destroys the writer should call
+  // flushThread before they finish.
+  class TraceWriter {
+  public:
+    explicit TraceWriter(std::ostream& out);
+    ~TraceWriter();
+    struct Event {
+      const char* name;
+      // The position of the sound change, if any, or -1. This is copied
+      // because the script might be gone by the time the event is written.
+      size_t line, col;
+      uint64_t start, duration; // in ns since the writer was created
+      uint32_t tid;
+    };
+    void record(const Event& e);
+    // Write out the events that this thread has buffered.
+    void flushThread();
+    uint64_t now() const;
+  private:
+    void write(const std::vector<Event>& events);
+    std::ostream& out;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point epoch;
+    bool first = true;
+  };
+  // The writer that spans are recorded into, or null if tracing is off.
+  // Set this before starting any threads.
+  extern TraceWriter* activeTrace;
+  // Records a span from its construction to its destruction.
+  class TraceSpan {
+  public:
+    explicit TraceSpan(const char* name, const Rule* rule = nullptr) :
+        name(name), rule(rule),
+        start((activeTrace != nullptr) ? activeTrace->now() : 0) {}
+    ~TraceSpan();
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+  private:
+    const char* name;
+    const Rule* rule;
+    uint64_t start;
+  };
+}
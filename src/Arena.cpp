@@ -0,0 +1,46 @@
+#include "Arena.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+
+namespace sca {
+  thread_local Arena* scratchArena = nullptr;
+  void* Arena::allocate(size_t n, size_t align) {
+    while (true) {
+      if (chunk == chunks.size()) {
+        // Out of chunks; add one that's big enough for this request.
+        size_t size = std::max(CHUNK_SIZE, n + align);
+        chunks.push_back(Chunk{std::make_unique<char[]>(size), size});
+        offset = 0;
+      }
+      Chunk& c = chunks[chunk];
+      uintptr_t base = (uintptr_t) c.data.get();
+      uintptr_t p = (base + offset + align - 1) & ~(uintptr_t) (align - 1);
+      if (p + n <= base + c.size) {
+        offset = p + n - base;
+        return (void*) p;
+      }
+      ++chunk;
+      offset = 0;
+    }
+  }
+  size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const Chunk& c : chunks) total += c.size;
+    return total;
+  }
+  Arena& getThreadArena() {
+    static thread_local Arena arena;
+    return arena;
+  }
+  ArenaScope::ArenaScope() : previous(scratchArena) {
+    Arena& arena = getThreadArena();
+    m = arena.mark();
+    scratchArena = &arena;
+  }
+  ArenaScope::~ArenaScope() {
+    getThreadArena().release(m);
+    scratchArena = previous;
+  }
+}
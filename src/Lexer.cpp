@@ -107,6 +107,7 @@ namespace sca {
         int d = cursor.read();
         switch (d) {
           case '(': RETURN_OP(Operator::dlb);
+          case '[': RETURN_OP(Operator::dlsb);
           case '$': {
             // Get characters until a `$$`
             std::string code;
@@ -176,6 +177,8 @@ namespace sca {
           else if (s == "ordered") t.contents = Operator::kwOrdered;
           else if (s == "executeOnce") t.contents = Operator::kwExecuteOnce;
           else if (s == "setOptions") t.contents = Operator::kwSetOptions;
+          else if (s == "syllables") t.contents = Operator::kwSyllables;
+          else if (s == "checkpoint") t.contents = Operator::kwCheckpoint;
           else t.contents = std::move(s);
           return t;
         } else if (isdigit(c)) {
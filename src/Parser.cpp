@@ -64,6 +64,16 @@ namespace sca {
     const Token& t = getToken();
     return t.get<LuaCode>();
   }
+  // Is the next token the `pure` that marks Γ? It has to come right before
+  // Γ, and it ends the string before it.
+  bool Parser::atPureGamma() {
+    const Token& t = peekToken();
+    if (!t.is<std::string>() || t.as<std::string>() != "pure") return false;
+    ++index;
+    bool res = peekToken().is<LuaCode>();
+    --index;
+    return res;
+  }
   #define REQUIRE(x) if (!(x).has_value()) return std::nullopt;
   #define REQUIRE_OPERATOR(x) REQUIRE(parseOperator(x))
   #define CHECK_ERROR_CODE(ec) \
@@ -243,6 +253,32 @@ namespace sca {
       atLeastOne = true;
     }
   }
+  std::optional<CharMatcher::Group> Parser::parseMatcherGroup() {
+    // constraint_group := ['!'] '(' constraints ('|' constraints)* ')'
+    CharMatcher::Group g;
+    if (peekToken().isOperator(Operator::bang)) {
+      getToken();
+      g.negated = true;
+    }
+    REQUIRE_OPERATOR(Operator::lb)
+    g.options.emplace_back();
+    while (true) {
+      auto constraint = parseMatcherConstraint();
+      REQUIRE(constraint)
+      g.options.back().push_back(std::move(*constraint));
+      const Token& t = peekToken();
+      if (t.isOperator(Operator::comma)) {
+        getToken();
+      } else if (t.isOperator(Operator::pipe)) {
+        getToken();
+        g.options.emplace_back();
+      } else {
+        break;
+      }
+    }
+    REQUIRE_OPERATOR(Operator::rb)
+    return g;
+  }
   std::optional<CharMatcher> Parser::parseMatcher() {
     // char_matcher := '$(' class [':' int] ['|' class_constraints] ')'
     REQUIRE_OPERATOR(Operator::dlb);
@@ -268,11 +304,18 @@ namespace sca {
       getToken();
       std::vector<CharMatcher::Constraint> constraints;
       while (true) {
-        auto constraint = parseMatcherConstraint();
-        REQUIRE(constraint)
-        constraints.push_back(*constraint);
         const Token& t2 = peekToken();
-        if (!t2.isOperator(Operator::comma)) break;
+        if (t2.isOperator(Operator::lb) || t2.isOperator(Operator::bang)) {
+          auto group = parseMatcherGroup();
+          REQUIRE(group)
+          matcher.groups.push_back(std::move(*group));
+        } else {
+          auto constraint = parseMatcherConstraint();
+          REQUIRE(constraint)
+          constraints.push_back(*constraint);
+        }
+        const Token& t3 = peekToken();
+        if (!t3.isOperator(Operator::comma)) break;
         getToken();
       }
       matcher.constraints = std::move(constraints);
@@ -301,6 +344,7 @@ namespace sca {
       reservePhonemes.pop_front();
       return true;
     }
+    if (atPureGamma()) return false;
     size_t oldIndex = index;
     std::optional<std::string> phonemes = parseString();
     if (phonemes.has_value()) {
@@ -443,8 +487,108 @@ namespace sca {
       if (!t->isOperator(Operator::envOr)) return false;
     }
   }
+  std::optional<size_t> Parser::parseConditionClass() {
+    // '(' class ')'
+    REQUIRE_OPERATOR(Operator::lb)
+    std::optional<std::string> cname = parseString();
+    REQUIRE(cname)
+    size_t id;
+    CharClass* cclass;
+    Error res = sca->getClassByName(*cname, id, cclass);
+    CHECK_ERROR_CODE(res)
+    REQUIRE_OPERATOR(Operator::rb)
+    return id;
+  }
+  std::optional<NativeCondition> Parser::parseNativeCondition() {
+    // condition := quantity comparison int | ['!'] 'has' '(' class ')' |
+    //   ['!'] syllable_flag
+    // quantity := 'length' | 'match' | 'before' | 'after' |
+    //   'count' '(' class ')' | 'syllables' | 'syllablesBefore' |
+    //   'syllablesAfter'
+    // syllable_flag := 'onset' | 'nucleus' | 'coda' | 'closed' | 'boundary'
+    using Quantity = NativeCondition::Quantity;
+    NativeCondition nc;
+    bool negated = peekToken().isOperator(Operator::bang);
+    if (negated) getToken();
+    // `syllables` is lexed as the keyword.
+    std::optional<std::string> name;
+    if (peekToken().isOperator(Operator::kwSyllables)) {
+      getToken();
+      name = "syllables";
+    } else name = parseString();
+    REQUIRE(name)
+    if (*name == "has") {
+      auto cc = parseConditionClass();
+      REQUIRE(cc)
+      nc.q = Quantity::classCount;
+      nc.charClass = *cc;
+      nc.c = negated ? Comparison::eq : Comparison::gt;
+      nc.value = 0;
+      return nc;
+    }
+    auto needSyllables = [&]() {
+      if (sca->getSyllabifier() != nullptr) return true;
+      printError(ErrorCode::noSyllables);
+      printLineColumn();
+      return false;
+    };
+    static const std::pair<const char*, Quantity> syllableFlags[] = {
+      {"onset", Quantity::onset},
+      {"nucleus", Quantity::nucleus},
+      {"coda", Quantity::coda},
+      {"closed", Quantity::closed},
+      {"boundary", Quantity::boundary},
+    };
+    for (const auto& [flag, q] : syllableFlags) {
+      if (*name != flag) continue;
+      if (!needSyllables()) return std::nullopt;
+      nc.q = q;
+      nc.c = negated ? Comparison::eq : Comparison::ne;
+      nc.value = 0;
+      return nc;
+    }
+    if (negated) return std::nullopt;
+    if (*name == "length") nc.q = Quantity::wordLength;
+    else if (*name == "match") nc.q = Quantity::matchLength;
+    else if (*name == "before") nc.q = Quantity::before;
+    else if (*name == "after") nc.q = Quantity::after;
+    else if (*name == "syllables") nc.q = Quantity::syllableCount;
+    else if (*name == "syllablesBefore") nc.q = Quantity::syllablesBefore;
+    else if (*name == "syllablesAfter") nc.q = Quantity::syllablesAfter;
+    else if (*name == "count") {
+      auto cc = parseConditionClass();
+      REQUIRE(cc)
+      nc.q = Quantity::classCount;
+      nc.charClass = *cc;
+    } else {
+      std::cerr << *name << " is not a valid condition\n";
+      printLineColumn();
+      return std::nullopt;
+    }
+    if (nc.isSyllabic() && !needSyllables()) return std::nullopt;
+    std::optional<Comparison> c = parseComparison();
+    REQUIRE(c)
+    nc.c = *c;
+    std::optional<size_t> value = parseNumber();
+    REQUIRE(value)
+    nc.value = *value;
+    return nc;
+  }
+  bool Parser::parseNativeConditions(SimpleRule& r) {
+    // native_conditions := '$[' condition (',' condition)* ']'
+    if (!parseOperator(Operator::dlsb).has_value()) return false;
+    while (true) {
+      auto nc = parseNativeCondition();
+      if (!nc.has_value()) return false;
+      r.conditions.push_back(*nc);
+      const Token& t = getToken();
+      if (t.isOperator(Operator::rsb)) return true;
+      if (!t.isOperator(Operator::comma)) return false;
+    }
+  }
   std::optional<std::unique_ptr<SimpleRule>> Parser::parseSimpleRule() {
-    // simple_rule := string '->' string env
+    // simple_rule := string '->' string env [native_conditions]
+    //   [['pure'] lua_code]
     std::optional<MString> alpha = parseString(false);
     REQUIRE(alpha)
     REQUIRE_OPERATOR(Operator::arrow)
@@ -460,10 +604,17 @@ namespace sca {
       r->envs.clear();
       r->inv = false;
     }
+    if (peekToken().isOperator(Operator::dlsb) && !parseNativeConditions(*r))
+      return std::nullopt;
+    if (atPureGamma()) {
+      getToken();
+      r->pureGamma = true;
+    }
     const Token& gamma = peekToken();
     if (gamma.is<LuaCode>()) {
       getToken();
-      bool res = r->setGamma(sca->getLuaState(), gamma.as<LuaCode>().code);
+      bool res =
+        r->setGamma(sca->requireLuaState(), gamma.as<LuaCode>().code);
       if (!res) {
         std::cerr << lua_tostring(sca->getLuaState(), -1) << "\n";
         return std::nullopt;
@@ -555,8 +706,10 @@ namespace sca {
           break;
         }
         getToken();
-        const std::string& s = t.as<std::string>();
-        sc.poses.insert(s);
+        size_t pos = sca->internPOS(t.as<std::string>());
+        if (std::find(sc.poses.begin(), sc.poses.end(), pos) ==
+            sc.poses.end())
+          sc.poses.push_back(pos);
         atLeastOne = true;
       }
       t = &peekToken();
@@ -568,6 +721,52 @@ namespace sca {
     REQUIRE_OPERATOR(Operator::kwExecuteOnce);
     return parseLuaCode();
   }
+  std::optional<Syllabifier> Parser::parseSyllables() {
+    /*
+    syllables_def := 'syllables' '{' syllables_body* '}'
+    syllables_body := ('nucleus' | 'onset' | 'coda') ':' char+ ';'
+    */
+    REQUIRE_OPERATOR(Operator::kwSyllables)
+    REQUIRE_OPERATOR(Operator::lcb)
+    Syllabifier syl;
+    while (true) {
+      const Token& t = peekToken();
+      if (t.isOperator(Operator::rcb)) {
+        getToken();
+        break;
+      } else if (t.is<EndOfFile>()) return std::nullopt;
+      std::optional<std::string> part = parseString();
+      REQUIRE(part)
+      REQUIRE_OPERATOR(Operator::colon)
+      MString m;
+      parseStringNoAlt(m, false);
+      // Only phonemes and matchers, one per phoneme
+      if (m.empty() || !std::all_of(m.begin(), m.end(),
+          [](const MChar& c) { return c.isSingleCharacter(); }))
+        return std::nullopt;
+      REQUIRE_OPERATOR(Operator::semicolon)
+      if (*part == "nucleus") {
+        for (MChar& c : m) syl.nuclei.push_back(std::move(c));
+      } else if (*part == "onset") {
+        syl.onsets.push_back(std::move(m));
+      } else if (*part == "coda") {
+        syl.codas.push_back(std::move(m));
+      } else {
+        std::cerr << *part << " is not a part of a syllable\n";
+        return std::nullopt;
+      }
+    }
+    if (syl.nuclei.empty()) return std::nullopt;
+    return syl;
+  }
+  std::optional<std::string> Parser::parseCheckpoint() {
+    // checkpoint := 'checkpoint' name ';'
+    REQUIRE_OPERATOR(Operator::kwCheckpoint)
+    std::optional<std::string> name = parseString();
+    REQUIRE(name)
+    REQUIRE_OPERATOR(Operator::semicolon)
+    return name;
+  }
   bool Parser::parseSoundChangeOptionChange() {
     if (!parseOperator(Operator::kwSetOptions)) return false;
     bool succ = parseSCOptions(defaultOptions);
@@ -615,19 +814,36 @@ namespace sca {
       return ErrorCode::ok;
     }
     size_t indexSCOC = index;
-    size_t farthest = std::max({indexSC, indexFeature, indexCC, indexGLC, indexSCOC});
+    index = oldIndex; // backtrack
+    auto syllables = parseSyllables();
+    if (syllables.has_value()) {
+      return sca->setSyllabifier(std::move(*syllables));
+    }
+    size_t indexSyl = index;
+    index = oldIndex; // backtrack
+    size_t cpline = peekToken().line, cpcol = peekToken().col;
+    auto checkpoint = parseCheckpoint();
+    if (checkpoint.has_value()) {
+      return sca->insertCheckpoint(std::move(*checkpoint), cpline, cpcol);
+    }
+    size_t indexCP = index;
+    size_t farthest = std::max({
+      indexSC, indexFeature, indexCC, indexGLC, indexSCOC, indexSyl, indexCP});
     // std::max(indexSC, std::max(indexFeature, indexCC));
     if (farthest == indexSC) which = 0;
     else if (farthest == indexFeature) which = 1;
     else if (farthest == indexCC) which = 2;
     else if (farthest == indexGLC) which = 3;
-    else which = 4;
+    else if (farthest == indexSCOC) which = 4;
+    else if (farthest == indexSyl) which = 5;
+    else which = 6;
     index = farthest;
     return std::nullopt;
   }
   static const char* things[] = {
     "sound change", "feature definition", "character class definition",
-    "global Lua code", "sound change option setting",
+    "global Lua code", "sound change option setting", "syllables declaration",
+    "checkpoint",
   };
   bool Parser::parse() {
     bool ok = true;
@@ -5,15 +5,21 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
+#include <unordered_set>
 
 #include "SCA.h"
 #include "iterutils.h"
 #include "matching.h"
+#include "profile.h"
+#include "scan.h"
+#include "syllables.h"
 #include "sca_lua.h"
+#include "trace.h"
 
 /*
   For the implementation of the SimpleRule::verify and CompoundRule::verify
-  methods, see verify_rule.cpp.
+  methods (as well as classify), see verify_rule.cpp.
 */
 
 namespace sca {
@@ -22,6 +28,10 @@ namespace sca {
       featureValues[f] :
       sca.getFeatureByID(f).def;
   }
+  void PhonemeSpec::fillFeatureValues(const SCA& sca) {
+    for (size_t f = featureValues.size(); f < sca.getFeatureCount(); ++f)
+      featureValues.push_back(sca.getFeatureByID(f).def);
+  }
   void PhonemeSpec::setFeatureValue(size_t f, size_t i, const SCA& sca) {
     size_t os = featureValues.size();
     if (f >= os) {
@@ -46,31 +56,86 @@ namespace sca {
   }
   bool CharMatcher::Constraint::matches(
       size_t inst, const MatchCapture& mc, const SCA& sca) const {
-    std::vector<size_t> itrans(instances.size());
+    // = and != look for any instance that's equal; the others need all of
+    // the instances to compare in the right way.
+    bool any = c == Comparison::eq || c == Comparison::ne;
     for (size_t i = 0; i < instances.size(); ++i) {
-      itrans[i] = evaluate(i, mc, sca);
-    }
-    switch (c) {
-      case Comparison::eq: {
-        auto it = std::find(itrans.begin(), itrans.end(), inst);
-        return it != itrans.end();
+      size_t o = evaluate(i, mc, sca);
+      bool res = false;
+      switch (c) {
+        case Comparison::eq:
+        case Comparison::ne: res = inst == o; break;
+        case Comparison::lt: res = inst < o; break;
+        case Comparison::gt: res = inst > o; break;
+        case Comparison::le: res = inst <= o; break;
+        case Comparison::ge: res = inst >= o; break;
       }
-      case Comparison::ne: {
-        auto it = std::find(itrans.begin(), itrans.end(), inst);
-        return it == itrans.end();
+      if (res == any) return (c == Comparison::ne) ? !any : any;
+    }
+    return (c == Comparison::ne) ? any : !any;
+  }
+  bool CharMatcher::Constraint::isDependent() const {
+    return std::any_of(instances.begin(), instances.end(),
+      [](const IV& inst) {
+        return std::holds_alternative<std::pair<size_t, size_t>>(inst);
+      });
+  }
+  bool CharMatcher::Group::matches(
+      const PhonemeSpec& ps, const SCA& sca) const {
+    static const MatchCapture noCaptures;
+    bool any = std::any_of(options.begin(), options.end(),
+      [&](const std::vector<Constraint>& cons) {
+        return std::all_of(cons.begin(), cons.end(),
+          [&](const Constraint& con) {
+            return con.matches(
+              ps.getFeatureValue(con.feature, sca), noCaptures, sca);
+          });
+      });
+    return any != negated;
+  }
+  std::string CharMatcher::Group::toString(const SCA& sca) const {
+    std::string s = negated ? "!(" : "(";
+    for (size_t i = 0; i < options.size(); ++i) {
+      if (i != 0) s += " | ";
+      for (size_t j = 0; j < options[i].size(); ++j) {
+        if (j != 0) s += ", ";
+        s += options[i][j].toString(sca);
       }
-      #define CMPCASE(name, op) \
-        case Comparison::name: { \
-          return std::all_of(itrans.begin(), itrans.end(), \
-            [inst](size_t o) { \
-              return inst op o; \
-            }); \
-        }
-      CMPCASE(lt, <)
-      CMPCASE(gt, >)
-      CMPCASE(le, <=)
-      CMPCASE(ge, >=)
     }
+    return s + ")";
+  }
+  bool CharMatcher::constrains(size_t f) const {
+    for (const Constraint& con : getConstraints())
+      if (con.feature == f) return true;
+    for (const Group& g : groups)
+      for (const std::vector<Constraint>& opt : g.options)
+        for (const Constraint& con : opt)
+          if (con.feature == f) return true;
+    return false;
+  }
+  bool CharMatcher::acceptsStatically(
+      const PhonemeSpec& ps, const SCA& sca) const {
+    static const MatchCapture noCaptures;
+    if (charClass != -1 && !ps.hasClass(charClass)) return false;
+    for (const Constraint& con : getConstraints()) {
+      if (con.isDependent()) continue;
+      if (!con.matches(ps.getFeatureValue(con.feature, sca), noCaptures, sca))
+        return false;
+    }
+    for (const Group& g : groups)
+      if (!g.matches(ps, sca)) return false;
+    return true;
+  }
+  void CharMatcher::compile(const SCA& sca) {
+    if (!hasConstraints()) return;
+    const std::vector<Constraint>& cons = getConstraints();
+    hasDependentConstraints = std::any_of(cons.begin(), cons.end(),
+      [](const Constraint& con) { return con.isDependent(); });
+    accepted = Bitset(sca.getPhonemeCount());
+    for (size_t id = 0; id < sca.getPhonemeCount(); ++id) {
+      if (acceptsStatically(sca.getPhonemeByID(id), sca)) accepted.set(id);
+    }
+    compiled = true;
   }
   std::string CharMatcher::toString(const SCA& sca) const {
     if (charClass == -1)
@@ -101,65 +166,319 @@ namespace sca {
     return s;
   }
   // ------------------------------------------------------------------
+  /*
+    Patterns are matched by backtracking: alternations try each option in
+    turn and repetitions take as many copies as they can, giving some back
+    if the rest of the pattern doesn't match otherwise. This is written in
+    continuation-passing style, so that backtracking can reach into
+    repetitions and alternations that have already been passed. The last
+    continuation is a check on the whole match (for α, its environment,
+    conditions and Γ; see matchesRule), so a match that it rejects makes
+    the pattern backtrack and try a different one.
+
+    Naive backtracking can take exponential time (think `[a|a]*`), so once
+    a match has taken a few hundred steps, we start remembering the points
+    from which we failed, and if we get back to a point in the same state
+    (the same continuation and the same captures), we fail straight away.
+    Repetitions with no upper bound don't count the copies above their
+    minimum as part of the state. In addition, a match is abandoned after
+    WordLimits::matchSteps steps, or if it recurses too deeply, which stops
+    the processing of the word (see limitReached).
+  */
+  // The number of steps after which failures start being remembered.
+  static constexpr size_t MEMO_THRESHOLD = 256;
+  // What is left to match after the current sequence: the rest of the
+  // sequence that contains `node` (from `rit` to `rend`) followed by
+  // `next`. If `rep` is not null, then the current sequence is copy
+  // number `copies` of it, starting at `copyStart`, and `node` is the
+  // repetition itself.
   template<typename CFwd, typename WFwd>
-  static std::optional<WFwd> matchesMChar(
-    WFwd istart, WFwd iend,
-    const MChar& ruleChar,
-    const SCA& sca,
-    MatchCapture& mc
-  ) {
-    if (ruleChar.isSingleCharacter()) {
-      if (istart == iend) return std::nullopt;
-      bool match = charsMatch(sca, ruleChar, **istart, mc);
-      if (match) return istart + 1;
-      else return std::nullopt;
-    }
-    // Does not necessarily match one and only one.
-    return std::visit([&](const auto& arg) -> std::optional<WFwd> {
-      using T = std::decay_t<decltype(arg)>;
-      if constexpr (std::is_same_v<T, Alternation>) {
-        // Try each option in succession and pick the first one that works
-        for (const MString& opt : arg.options) {
-          // Back up the MatchCapture, in case this option fails
-          MatchCapture mcback(mc);
-          auto it = matchesPattern(
-            istart, iend,
-            IRev<CFwd>::cbegin(opt), IRev<CFwd>::cend(opt),
-            sca, mc
-          );
-          if (it.has_value()) { // Success!
-            return *it;
+  struct MatchContinuation {
+    CFwd rit, rend;
+    const MatchContinuation* next;
+    const MChar* node;
+    const Repeat* rep;
+    size_t copies;
+    WFwd copyStart;
+    mutable size_t id = -1; // see PatternMatcher::idOf
+  };
+  // The copy count of a repetition that matters for what it can match
+  // next.
+  static size_t effectiveCopies(const Repeat& r, size_t copies) {
+    if (r.max == std::numeric_limits<size_t>::max())
+      return std::min(copies, r.min);
+    return copies;
+  }
+  struct MatchStateKey {
+    const void* node;
+    size_t copies, cont, pos, captures;
+    bool operator==(const MatchStateKey& o) const {
+      return node == o.node && copies == o.copies && cont == o.cont &&
+        pos == o.pos && captures == o.captures;
+    }
+  };
+  struct MatchStateHash {
+    size_t operator()(const MatchStateKey& k) const {
+      size_t h = std::hash<const void*>()(k.node);
+      for (size_t x : {k.copies, k.cont, k.pos, k.captures})
+        h = h * 0x100000001b3 ^ std::hash<size_t>()(x);
+      return h;
+    }
+  };
+  using CaptureState =
+    std::vector<std::pair<std::pair<size_t, size_t>, std::pair<
+      const PhonemeSpec*, size_t>>, ArenaAllocator<std::pair<
+        std::pair<size_t, size_t>, std::pair<const PhonemeSpec*, size_t>>>>;
+  struct CaptureStateHash {
+    size_t operator()(const CaptureState& cs) const {
+      size_t h = cs.size();
+      for (const auto& e : cs) {
+        h = h * 0x100000001b3 ^ PHash<size_t, size_t>()(e.first);
+        h = h * 0x100000001b3 ^ std::hash<const void*>()(e.second.first);
+        h = h * 0x100000001b3 ^ e.second.second;
+      }
+      return h;
+    }
+  };
+  template<typename K, typename V, typename H>
+  using ScratchMap = std::unordered_map<
+    K, V, H, std::equal_to<K>, ArenaAllocator<std::pair<const K, V>>>;
+  // Accepts every match of a pattern.
+  struct AcceptAnyMatch {
+    template<typename WFwd>
+    bool operator()(WFwd) const { return true; }
+  };
+  // `accept` is called with the end of each match of the whole pattern,
+  // and returns whether to take it. It has to depend only on the end and
+  // the captures (which it must leave as they were if it rejects the
+  // match), or the failures that are remembered would be wrong.
+  template<typename CFwd, typename WFwd, typename Accept>
+  class PatternMatcher {
+  public:
+    using Cont = MatchContinuation<CFwd, WFwd>;
+    PatternMatcher(
+        WFwd origin, WFwd iend, const SCA& sca, MatchCapture& mc,
+        Accept& accept) :
+      origin(origin), iend(iend), sca(sca), mc(mc), accept(accept),
+      maxSteps(sca.getLimits().matchSteps) {
+      if (maxSteps == 0) maxSteps = -1;
+    }
+    // If the pattern from `rit` to `rend` matches the text at `iit`,
+    // return the iterator to the end of the match.
+    std::optional<WFwd> matchSequence(
+        WFwd iit, CFwd rit, CFwd rend, const Cont* k) {
+      Nesting nesting(depth);
+      if (depth > MAX_MATCH_DEPTH) {
+        abandoned = true;
+        limitReached = Limit::matchDepth;
+        return std::nullopt;
+      }
+      while (true) {
+        if (!step()) return std::nullopt;
+        if (rit == rend) return finish(iit, k);
+        const MChar& c = *rit;
+        if (!c.isSingleCharacter()) break;
+        if (iit == iend) {
+          // A word boundary ends the sequence that it's in.
+          if (c.is<Space>()) return finish(iit, k);
+          return std::nullopt;
+        }
+        size_t oldSize = mc.size();
+        if (!charsMatch(sca, c, **iit, mc)) return std::nullopt;
+        if (mc.size() != oldSize) {
+          // This matcher captured a phoneme, which has to be forgotten
+          // if we backtrack past it.
+          auto res = matchSequence(iit + 1, std::next(rit), rend, k);
+          if (!res.has_value()) {
+            const CharMatcher& m = c.as<CharMatcher>();
+            mc.erase(std::pair(m.charClass, m.index));
           }
-          mc = mcback; // Restore
+          return res;
         }
-        return std::nullopt;
-      } else if constexpr (std::is_same_v<T, Repeat>) {
-        size_t nCopies = 0;
-        WFwd it = istart;
-        while (true) {
-          if (it >= iend) break; // Passed the end; can't match anymore
-          if (nCopies > arg.max) break; // Can't match more copies
-          auto matchEnd = matchesPattern(
-            it, iend,
-            IRev<CFwd>::cbegin(arg.s), IRev<CFwd>::cend(arg.s),
-            sca, mc
-          );
-          if (!matchEnd.has_value()) break; // No match
-          ++nCopies; // Otherwise, record success and prepare for next
-          it = *matchEnd;
+        ++iit;
+        ++rit;
+      }
+      return std::visit([&](const auto& arg) -> std::optional<WFwd> {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, Alternation>) {
+          Cont after{std::next(rit), rend, k, &*rit, nullptr, 0, iit};
+          size_t cont = -1, captures = -1;
+          if (remembering()) {
+            cont = idOf(&after);
+            captures = captureID();
+            if (hasFailed(&*rit, 0, cont, iit, captures)) return std::nullopt;
+          }
+          for (const MString& opt : arg.options) {
+            auto res = matchSequence(
+              iit, IRev<CFwd>::cbegin(opt), IRev<CFwd>::cend(opt), &after);
+            if (res.has_value() || abandoned) return res;
+          }
+          if (cont != -1) fail(&*rit, 0, cont, iit, captures);
+          return std::nullopt;
+        } else if constexpr (std::is_same_v<T, Repeat>) {
+          return matchCopies(iit, arg, 0, std::next(rit), rend, k, &*rit);
+        } else {
+          std::cerr << "matchSequence: We missed a case!\n";
+          abort();
+          return std::nullopt;
         }
-        if (nCopies < arg.min || nCopies > arg.max) return std::nullopt;
-        return it;
-      } else {
-        std::cerr << "matchesMChar: We missed a case!\n";
-        abort();
+      }, rit->value);
+    }
+  private:
+    struct Nesting {
+      Nesting(size_t& d) : d(d) { ++d; }
+      ~Nesting() { --d; }
+      size_t& d;
+    };
+    // Count a step, and abandon the match if there have been too many.
+    bool step() {
+      if (abandoned) return false;
+      if (++steps > maxSteps) {
+        abandoned = true;
+        limitReached = Limit::matchSteps;
+        return false;
+      }
+      return true;
+    }
+    bool remembering() const { return steps > MEMO_THRESHOLD; }
+    // Finish matching a sequence at `iit`, and go on to `k`.
+    std::optional<WFwd> finish(WFwd iit, const Cont* k) {
+      if (k == nullptr) {
+        if (accept(iit)) return iit;
+        // Γ might have reached a limit.
+        if (limitReached != Limit::none) abandoned = true;
         return std::nullopt;
       }
-    }, ruleChar.value);
-  }
-  // If the pattern matches the text at the start point, return the iterator
-  // to the end of the match. Otherwise, return std::nullopt.
-  template<typename CFwd, typename WFwd
+      if (k->rep == nullptr) return matchSequence(iit, k->rit, k->rend, k->next);
+      // Finished one copy of a repetition. If it was empty, then any
+      // further copies could be too, so stop here.
+      if (iit == k->copyStart)
+        return matchSequence(iit, k->rit, k->rend, k->next);
+      return matchCopies(
+        iit, *k->rep, k->copies, k->rit, k->rend, k->next, k->node);
+    }
+    // Match more copies of `r` at `iit`, having matched `copies` of them
+    // already, and then the rest of the sequence (`rit` to `rend`) and
+    // `next`.
+    std::optional<WFwd> matchCopies(
+        WFwd iit, const Repeat& r, size_t copies,
+        CFwd rit, CFwd rend, const Cont* next, const MChar* node) {
+      size_t cont = -1, captures = -1, ec = effectiveCopies(r, copies);
+      if (remembering()) {
+        cont = (next != nullptr) ? idOf(next) : 0;
+        captures = captureID();
+        if (hasFailed(node, ec, cont, iit, captures)) return std::nullopt;
+      }
+      if (r.s.size() == 1 && r.s[0].isSingleCharacter()) {
+        auto res = matchCharCopies(iit, r, copies, rit, rend, next);
+        if (!res.has_value() && cont != -1)
+          fail(node, ec, cont, iit, captures);
+        return res;
+      }
+      // Try to match one more copy first.
+      if (copies < r.max) {
+        Cont c{rit, rend, next, node, &r, copies + 1, iit};
+        auto res = matchSequence(
+          iit, IRev<CFwd>::cbegin(r.s), IRev<CFwd>::cend(r.s), &c);
+        if (res.has_value() || abandoned) return res;
+      }
+      if (copies >= r.min) {
+        auto res = matchSequence(iit, rit, rend, next);
+        if (res.has_value() || abandoned) return res;
+      }
+      if (cont != -1) fail(node, ec, cont, iit, captures);
+      return std::nullopt;
+    }
+    // The same, for a repetition of a single character. These are matched
+    // without recursion, so that they can cover long words.
+    std::optional<WFwd> matchCharCopies(
+        WFwd iit, const Repeat& r, size_t copies,
+        CFwd rit, CFwd rend, const Cont* next) {
+      const MChar& c = r.s[0];
+      size_t oldSize = mc.size();
+      size_t n = 0;
+      for (WFwd it = iit; copies + n < r.max && it != iend; ++it, ++n) {
+        if (!step()) return std::nullopt;
+        if (!charsMatch(sca, c, **it, mc)) break;
+      }
+      for (size_t j = n + 1; j-- > 0 && copies + j >= r.min;) {
+        if (j == 0 && mc.size() != oldSize) {
+          // The first copy captured a phoneme, so forget it.
+          const CharMatcher& m = c.as<CharMatcher>();
+          mc.erase(std::pair(m.charClass, m.index));
+        }
+        auto res = matchSequence(iit + j, rit, rend, next);
+        if (res.has_value() || abandoned) return res;
+      }
+      if (mc.size() != oldSize) {
+        const CharMatcher& m = c.as<CharMatcher>();
+        mc.erase(std::pair(m.charClass, m.index));
+      }
+      return std::nullopt;
+    }
+    // Continuations are identified by the node that they come from, the
+    // number of copies (if it's a repetition) and the continuation they go
+    // on to. 0 is reserved for the end of the pattern.
+    //
+    // Where the current copy of a repetition started (copyStart) is left
+    // out. It only matters if the copy is still empty at the position of
+    // the state, in which case finishing the copy ends the repetition (see
+    // finish). Reaching the same state with a copy that isn't empty adds
+    // nothing but more copies from that position, and those were already
+    // tried as part of the empty copy itself, with one copy fewer (which
+    // allows no less, since the copies can be empty). That attempt is over
+    // by the time that the other state is reached, so if the empty copy
+    // failed, so does the other one; and the empty copy can do nothing
+    // that the other one can't.
+    size_t idOf(const Cont* k) {
+      if (k == nullptr) return 0;
+      if (k->id != -1) return k->id;
+      size_t copies = (k->rep != nullptr) ?
+        effectiveCopies(*k->rep, k->copies) : -1;
+      MatchStateKey key{k->node, copies, idOf(k->next), 0, 0};
+      auto res = continuations.try_emplace(key, continuations.size() + 1);
+      k->id = res.first->second;
+      return k->id;
+    }
+    // Identify the current set of captures.
+    size_t captureID() {
+      CaptureState cs;
+      cs.reserve(mc.size());
+      for (const auto& p : mc)
+        cs.emplace_back(p.first, std::pair(p.second.ps, p.second.index));
+      std::sort(cs.begin(), cs.end());
+      auto res = captureStates.try_emplace(std::move(cs), captureStates.size());
+      return res.first->second;
+    }
+    bool hasFailed(
+        const void* node, size_t copies, size_t cont, WFwd iit,
+        size_t captures) const {
+      MatchStateKey key{node, copies, cont, (size_t) (iit - origin), captures};
+      return failures.count(key) != 0;
+    }
+    void fail(
+        const void* node, size_t copies, size_t cont, WFwd iit,
+        size_t captures) {
+      if (abandoned) return;
+      failures.insert(
+        MatchStateKey{node, copies, cont, (size_t) (iit - origin), captures});
+    }
+    WFwd origin, iend;
+    const SCA& sca;
+    MatchCapture& mc;
+    Accept& accept;
+    size_t steps = 0, depth = 0, maxSteps;
+    bool abandoned = false;
+    ScratchMap<MatchStateKey, size_t, MatchStateHash> continuations;
+    ScratchMap<CaptureState, size_t, CaptureStateHash> captureStates;
+    std::unordered_set<
+      MatchStateKey, MatchStateHash, std::equal_to<MatchStateKey>,
+      ArenaAllocator<MatchStateKey>> failures;
+  };
+  // If the pattern matches the text at the start point in a way that
+  // `accept` takes (see PatternMatcher), return the iterator to the end of
+  // the match. Otherwise, return std::nullopt.
+  template<typename CFwd, typename WFwd, typename Accept = AcceptAnyMatch
   > // templated to handle both fwd and rev cases
   static std::optional<WFwd> matchesPattern(
     WFwd istart, // where to start looking
@@ -167,38 +486,67 @@ namespace sca {
     CFwd rstart, // iterator to start of rule
     CFwd rend, // iterator to end of rule
     const SCA& sca,
-    MatchCapture& mc
+    MatchCapture& mc,
+    Accept&& accept = Accept()
   ) {
     WFwd iit = istart;
     CFwd rit = rstart;
+    // Most patterns are made of single characters only, which don't need
+    // any backtracking.
     while (true) {
       if (rit == rend) // all chars matched
-        return iit;
+        break;
+      if (!rit->isSingleCharacter()) {
+        PatternMatcher<CFwd, WFwd, Accept> matcher(
+          istart, iend, sca, mc, accept);
+        return matcher.matchSequence(iit, rit, rend, nullptr);
+      }
       if (iit == iend) { // end of string but unmatched chars
-        if (rit->template is<Space>()) return iit;
+        if (rit->template is<Space>()) break;
         return std::nullopt;
       }
-      const auto& inRule = *rit;
-      auto matchEnd = matchesMChar<CFwd, WFwd>(iit, iend, inRule, sca, mc);
-      if (!matchEnd.has_value()) return std::nullopt;
+      if (!charsMatch(sca, *rit, **iit, mc)) return std::nullopt;
       ++rit;
-      iit = *matchEnd;
+      ++iit;
     }
+    if (!accept(iit)) return std::nullopt;
+    return iit;
   }
-  template<typename Fwd, typename CFwd, typename WFwd>
+  std::optional<size_t> matchPatternLTR(
+      const SCA& sca, WString& word, size_t start, const MString& pattern,
+      MatchCapture& mc) {
+    auto istart = word.begin() + start;
+    auto end = matchesPattern(
+      istart, word.end(), pattern.cbegin(), pattern.cend(), sca, mc);
+    if (!end.has_value()) return std::nullopt;
+    return *end - istart;
+  }
+  std::optional<size_t> matchPatternRTL(
+      const SCA& sca, WString& word, size_t start, const MString& pattern,
+      MatchCapture& mc) {
+    auto istart = word.rbegin() + start;
+    auto end = matchesPattern(
+      istart, word.rend(), pattern.crbegin(), pattern.crend(), sca, mc);
+    if (!end.has_value()) return std::nullopt;
+    return *end - istart;
+  }
+  // `iback` is where the text before `ipoint` ends; they're different only
+  // if the word has a gap there. `holds` is called with the length of each
+  // match of α that the environment allows, and returns whether the other
+  // checks on it (conditions and Γ) pass; if not, α backtracks.
+  template<typename Fwd, typename CFwd, typename WFwd, typename Holds>
   static std::optional<WFwd> matchesRule(
-    // v text start / search start / text end
-    WFwd istart, WFwd ipoint, WFwd iend,
+    // v text start / end of text before search start / search start / text end
+    WFwd istart, WFwd iback, WFwd ipoint, WFwd iend,
     CFwd astart, CFwd aend, // alpha
     const std::vector<std::pair<MString, MString>>& envs, // envs
     bool envInverted, // Match if environment is NOT matched (vs matched)?
     const SCA& sca,
-    MatchCapture& mc
+    MatchCapture& mc,
+    Holds&& holds
   ) {
-    auto amatch = matchesPattern(ipoint, iend, astart, aend, sca, mc);
-    if (!amatch) return std::nullopt;
-    WFwd ipend = *amatch;
-    auto matchesEnv = [=, &sca, &mc]() -> bool {
+    RuleProfile* prof = currentRuleProfile;
+    auto matchesEnv = [=, &sca, &mc](WFwd ipend) -> bool {
       // Special case: if there's no environment, then always pass
       // the environment check
       if (envs.empty()) return true;
@@ -211,7 +559,7 @@ namespace sca {
         CFwd rstart = IRev<Fwd>::cbegin(rho);
         CFwd rend = IRev<Fwd>::cend(rho);
         bool matchesLeft = matchesPattern(
-            reverseIterator(ipoint), reverseIterator(istart),
+            reverseIterator(iback), reverseIterator(istart),
             reverseIterator(lend), reverseIterator(lstart),
             sca, mc).has_value();
         bool matchesRight = matchesPattern(
@@ -223,64 +571,104 @@ namespace sca {
       }
       return false; // none matched
     };
-    if (matchesEnv() == envInverted) return std::nullopt;
-    return ipend;
+    auto accept = [&](WFwd ipend) -> bool {
+      if (prof != nullptr) ++prof->alphaMatches;
+      if (envs.empty()) return holds((size_t) (ipend - ipoint));
+      // Forget whatever the environment captured if this match is rejected.
+      bool hadCaptures = !mc.empty();
+      MatchCapture saved;
+      if (hadCaptures) saved = mc;
+      if (matchesEnv(ipend) == envInverted) {
+        if (prof != nullptr) ++prof->envRejections;
+      } else if (holds((size_t) (ipend - ipoint))) {
+        return true;
+      }
+      if (hadCaptures) mc = std::move(saved);
+      else mc.clear();
+      return false;
+    };
+    return matchesPattern(ipoint, iend, astart, aend, sca, mc, accept);
   }
   // ------------------------------------------------------------------
   std::optional<size_t> SimpleRule::tryReplaceLTR(
       const SCA& sca, WString& str, size_t start) const {
     MatchCapture mc;
-    auto istart = str.begin() + start;
+    auto istart = str.at(start);
     auto match = matchesRule<MSI, MSCI, WString::iterator>(
-      str.begin(), istart, str.end(),
+      str.begin(), str.endAt(start), istart, str.end(),
       alpha.begin(), alpha.end(),
       envs,
       inv,
       sca,
-      mc
+      mc,
+      [&](size_t s) {
+        if (!conditions.empty() && !conditionsHold(str, start, start + s))
+          return false;
+        return gammaref == LUA_NOREF || evaluate(sca, str, start, start + s);
+      }
     );
     if (!match) return std::nullopt;
     auto end = *match;
     assert(end >= istart);
     size_t s = (size_t) (end - istart);
-    bool gammaMatches = evaluate(sca.getLuaState(), str, start, start + s);
-    if (!gammaMatches) return std::nullopt;
+    if (replacementsLeft == 0) {
+      limitReached = Limit::replacements;
+      return std::nullopt;
+    }
+    if (str.size() - s + omega.size() > maxWordSize) {
+      limitReached = Limit::growth;
+      return std::nullopt;
+    }
     // Now replace subrange
     WString omegaApp;
+    omegaApp.reserve(omega.size());
     for (const MChar& oc : omega)
       omegaApp.push_back(applyOmega(sca, oc, mc));
-    replaceSubrange(
-      str, istart, end, omegaApp.begin(), omegaApp.end());
+    str.replace(start, start + s, omegaApp.begin(), omegaApp.end());
+    if (currentSyllables != nullptr)
+      currentSyllables->update(str, start, start + s, omegaApp.size());
     return s;
   }
   std::optional<size_t> SimpleRule::tryReplaceRTL(
       const SCA& sca, WString& str, size_t start) const {
     MatchCapture mc;
-    auto istart = str.rbegin() + start;
+    // The match, counted from the start of the word
+    size_t mend = str.size() - start;
+    auto istart = WString::reverse_iterator(str.endAt(mend));
     auto match = matchesRule<MSRI, MSRCI, WString::reverse_iterator>(
-      str.rbegin(), istart, str.rend(),
+      str.rbegin(), WString::reverse_iterator(str.at(mend)), istart,
+      str.rend(),
       alpha.rbegin(), alpha.rend(),
       envs,
       inv,
       sca,
-      mc
+      mc,
+      [&](size_t s) {
+        if (!conditions.empty() && !conditionsHold(str, mend - s, mend))
+          return false;
+        return gammaref == LUA_NOREF || evaluate(sca, str, mend - s, mend);
+      }
     );
     if (!match) return std::nullopt;
     auto end = *match;
     assert(end >= istart);
     size_t s = (size_t) (end - istart);
-    size_t eifwd = str.size() - 1 - start;
-    bool gammaMatches = evaluate(
-      sca.getLuaState(), str,
-      eifwd - s,
-      eifwd);
-    if (!gammaMatches) return std::nullopt;
+    if (replacementsLeft == 0) {
+      limitReached = Limit::replacements;
+      return std::nullopt;
+    }
+    if (str.size() - s + omega.size() > maxWordSize) {
+      limitReached = Limit::growth;
+      return std::nullopt;
+    }
     // Now replace subrange
     WString omegaApp;
+    omegaApp.reserve(omega.size());
     for (const MChar& oc : omega)
       omegaApp.push_back(applyOmega(sca, oc, mc));
-    replaceSubrange(
-      str, end.base(), istart.base(), omegaApp.begin(), omegaApp.end());
+    str.replace(mend - s, mend, omegaApp.begin(), omegaApp.end());
+    if (currentSyllables != nullptr)
+      currentSyllables->update(str, mend - s, mend, omegaApp.size());
     return s;
   }
   std::optional<size_t> CompoundRule::tryReplaceLTR(
@@ -299,6 +687,70 @@ namespace sca {
     }
     return std::nullopt;
   }
+  size_t SimpleRule::nextCandidateLTR(
+      const WString& word, size_t start) const {
+    size_t size = word.size();
+    // If α is pinned to one position, then look only there.
+    size_t p = start, end = size + 1;
+    if (anchoring.left != -1) {
+      p = anchoring.left;
+      if (start > p || p > size) return -1;
+      end = p + 1;
+    } else if (anchoring.right != -1 && anchoring.width != -1) {
+      size_t need = anchoring.right + anchoring.width;
+      if (need > size) return -1;
+      p = size - need;
+      if (start > p) return -1;
+      end = p + 1;
+    }
+    if (leading[0] == nullptr) return p;
+    return findLiteral(word, p, end, leading[0], leading[1]);
+  }
+  size_t SimpleRule::nextCandidateRTL(
+      const WString& word, size_t start) const {
+    size_t size = word.size();
+    // Positions are counted from the end here, so the roles of the
+    // two anchors are swapped.
+    size_t p = start, last = size;
+    if (anchoring.right != -1) {
+      p = anchoring.right;
+      if (start > p || p > size) return -1;
+      last = p;
+    } else if (anchoring.left != -1 && anchoring.width != -1) {
+      size_t need = anchoring.left + anchoring.width;
+      if (need > size) return -1;
+      p = size - need;
+      if (start > p) return -1;
+      last = p;
+    }
+    if (trailing[0] == nullptr) return p;
+    // α has to end somewhere between indices `lo` and `hi` of the word.
+    // If it ends in two literal phonemes, then look for the first of them.
+    if (p >= size) return -1;
+    size_t extra = (trailing[1] != nullptr) ? 1 : 0;
+    size_t hi = size - 1 - p, lo = size - 1 - std::min(last, size - 1);
+    if (hi < extra) return -1;
+    size_t i = findLiteralReverse(
+      word, std::max(lo, extra) - extra, hi - extra + 1,
+      extra ? trailing[1] : trailing[0], extra ? trailing[0] : nullptr);
+    if (i == -1) return -1;
+    return size - 1 - (i + extra);
+  }
+  // -1 is the largest size_t, so `std::min` does the right thing here.
+  size_t CompoundRule::nextCandidateLTR(
+      const WString& word, size_t start) const {
+    size_t p = -1;
+    for (const SimpleRule& sr : components)
+      p = std::min(p, sr.nextCandidateLTR(word, start));
+    return p;
+  }
+  size_t CompoundRule::nextCandidateRTL(
+      const WString& word, size_t start) const {
+    size_t p = -1;
+    for (const SimpleRule& sr : components)
+      p = std::min(p, sr.nextCandidateRTL(word, start));
+    return p;
+  }
   bool SimpleRule::setGamma(lua_State* luaState, const std::string_view& s) {
     char* buffer = new char[s.length() + 7];
     memcpy(buffer, "return ", 7);
@@ -309,9 +761,113 @@ namespace sca {
     gammaref = luaL_ref(luaState, LUA_REGISTRYINDEX);
     return true;
   }
-  bool SimpleRule::evaluate(lua_State* luaState,
+  static size_t syllableQuantity(
+      NativeCondition::Quantity q, const WString& word, size_t mstart) {
+    using Quantity = NativeCondition::Quantity;
+    const Syllables* syl = currentSyllables;
+    if (syl == nullptr) return 0;
+    // A match at the end of the word comes after the last syllable.
+    bool atEnd = mstart >= word.size();
+    switch (q) {
+      case Quantity::syllableCount: return syl->count();
+      case Quantity::syllablesBefore:
+        return atEnd ? syl->count() : syl->syllableAt(mstart);
+      case Quantity::syllablesAfter:
+        return atEnd ? 0 : syl->count() - syl->syllableAt(mstart) - 1;
+      case Quantity::onset:
+        return !atEnd && syl->roleAt(mstart) == SyllableRole::onset;
+      case Quantity::nucleus:
+        return !atEnd && syl->roleAt(mstart) == SyllableRole::nucleus;
+      case Quantity::coda:
+        return !atEnd && syl->roleAt(mstart) == SyllableRole::coda;
+      case Quantity::closed: return !atEnd && syl->isClosed(mstart);
+      case Quantity::boundary: return syl->startsSyllable(mstart);
+      default: return 0;
+    }
+  }
+  bool NativeCondition::holds(
+      const WString& word, size_t mstart, size_t mend) const {
+    size_t x = 0;
+    switch (q) {
+      case Quantity::wordLength: x = word.size(); break;
+      case Quantity::matchLength: x = mend - mstart; break;
+      case Quantity::before: x = mstart; break;
+      case Quantity::after: x = word.size() - mend; break;
+      case Quantity::classCount:
+        // The word might have a gap in it, so index it.
+        for (size_t i = 0; i < word.size(); ++i)
+          x += word[i]->hasClass(charClass);
+        break;
+      default: x = syllableQuantity(q, word, mstart); break;
+    }
+    switch (c) {
+      case Comparison::eq: return x == value;
+      case Comparison::ne: return x != value;
+      case Comparison::lt: return x < value;
+      case Comparison::gt: return x > value;
+      case Comparison::le: return x <= value;
+      case Comparison::ge: return x >= value;
+    }
+    return false;
+  }
+  bool SimpleRule::conditionsHold(
+      const WString& word, size_t mstart, size_t mend) const {
+    for (const NativeCondition& nc : conditions)
+      if (!nc.holds(word, mstart, mend)) return false;
+    return true;
+  }
+  std::optional<bool> GammaCache::find(const SimpleRule* rule,
+      const WString& word, size_t mstart, size_t mend) {
+    last.rule = rule;
+    last.mstart = mstart;
+    last.mend = mend;
+    last.word.clear();
+    lastCacheable = false;
+    for (size_t i = 0; i < word.size(); ++i) {
+      if (word[i]->id == (size_t) -1) return std::nullopt;
+      last.word.push_back(word[i]->id);
+    }
+    lastCacheable = true;
+    auto it = results.find(last);
+    if (it == results.end()) return std::nullopt;
+    return it->second;
+  }
+  void GammaCache::insert(bool result) {
+    if (!lastCacheable) return;
+    if (results.size() >= MAX_ENTRIES) results.clear();
+    results.emplace(last, result);
+  }
+  size_t GammaCache::KeyHash::operator()(const Key& k) const {
+    size_t h = std::hash<const void*>()(k.rule);
+    h = h * 0x100000001b3 ^ std::hash<size_t>()(k.mstart);
+    h = h * 0x100000001b3 ^ std::hash<size_t>()(k.mend);
+    for (size_t x : k.word) h = h * 0x100000001b3 ^ std::hash<size_t>()(x);
+    return h;
+  }
+  // Called by Lua when a Γ has run for too long.
+  static void stopGamma(lua_State* l, lua_Debug*) {
+    limitReached = Limit::luaInstructions;
+    luaL_error(l, "instruction limit reached");
+  }
+  bool SimpleRule::evaluate(const SCA& sca,
       const WString& word, size_t mstart, size_t mend) const {
-    if (gammaref == LUA_NOREF) return true;
+    assert(gammaref != LUA_NOREF);
+    RuleProfile* prof = currentRuleProfile;
+    GammaCache* cache = pureGamma ? &sca.getGammaCache() : nullptr;
+    if (cache != nullptr) {
+      std::optional<bool> cached = cache->find(this, word, mstart, mend);
+      if (cached.has_value()) {
+        if (prof != nullptr) ++prof->gammaCacheHits;
+        return *cached;
+      }
+    }
+    lua_State* luaState = sca.getLuaState();
+    TraceSpan span("Γ", this);
+    auto start = ProfileClock::time_point();
+    if (prof != nullptr) {
+      ++prof->gammaEvaluations;
+      start = ProfileClock::now();
+    }
     // Create M
     lua_newtable(luaState);
     lua_pushinteger(luaState, mstart + 1);
@@ -330,12 +886,27 @@ namespace sca {
     }
     lua_setglobal(luaState, "W");
     lua_geti(luaState, LUA_REGISTRYINDEX, gammaref);
+    size_t maxInstructions = sca.getLimits().luaInstructions;
+    // Setting the hook again restarts its count.
+    if (maxInstructions != 0)
+      lua_sethook(luaState, stopGamma, LUA_MASKCOUNT,
+        (int) std::min<size_t>(
+          maxInstructions, std::numeric_limits<int>::max()));
     int stat = lua_pcall(luaState, 0, 1, 0);
+    if (maxInstructions != 0) lua_sethook(luaState, nullptr, 0, 0);
+    if (stat != LUA_OK && limitReached == Limit::luaInstructions) {
+      lua_pop(luaState, 1);
+      if (prof != nullptr) prof->gammaNs += nsSince(start);
+      return false;
+    }
     if (stat != LUA_OK) {
       std::cerr << "Fatal error when evaluating a Γ:\n";
       std::cerr << lua_tostring(luaState, -1) << "\n";
       abort();
     }
-    return lua_toboolean(luaState, -1);
+    bool res = lua_toboolean(luaState, -1);
+    if (cache != nullptr) cache->insert(res);
+    if (prof != nullptr) prof->gammaNs += nsSince(start);
+    return res;
   }
 }
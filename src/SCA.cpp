@@ -5,36 +5,42 @@
 #include <algorithm>
 #include <iostream>
 
+#include "Arena.h"
+#include "matching.h"
+#include "profile.h"
 #include "sca_lua.h"
+#include "trace.h"
 #include "utf8.h"
 
 namespace sca {
+  // Split `s` into phonemes, taking the longest phoneme name that matches
+  // at each point. Phoneme names are at most `longest` bytes long.
   template<typename T>
   void splitIntoPhonemes(
-      const SCA& sca, const std::string_view s,
-      T& phonemes) {
-    size_t ei = s.length();
-    if (ei == 0) return;
-    const PhonemeSpec* ps = nullptr;
-    // Go from the whole string and chop off the last character until
-    // we get a match
-    std::string st(s);
-    while (ei >= 1) {
-      Error res = sca.getPhonemeByName(st, ps);
-      if (res == ErrorCode::ok) break;
-      st.pop_back();
-      --ei;
-    }
-    if (ps != nullptr) {
-      phonemes.push_back(std::move(st));
-      splitIntoPhonemes(sca, s.substr(ei), phonemes);
-    } else {
-      // No match found; just take the first codepoint
-      UTF8Iterator<const std::string_view> it(s);
-      ++it;
-      size_t pos = it.position();
-      phonemes.push_back(std::string(s.substr(0, pos)));
-      splitIntoPhonemes(sca, s.substr(pos), phonemes);
+      const SCA& sca, std::string_view s,
+      T& phonemes, size_t longest = -1) {
+    std::string st;
+    while (!s.empty()) {
+      size_t ei = std::min(s.length(), longest);
+      const PhonemeSpec* ps = nullptr;
+      // Go from the longest possible name and chop off the last character
+      // until we get a match
+      st.assign(s.substr(0, ei));
+      while (ei >= 1) {
+        Error res = sca.getPhonemeByName(st, ps);
+        if (res == ErrorCode::ok) break;
+        st.pop_back();
+        --ei;
+      }
+      if (ps == nullptr) {
+        // No match found; just take the first codepoint
+        UTF8Iterator<const std::string_view> it(s);
+        ++it;
+        ei = it.position();
+        st.assign(s.substr(0, ei));
+      }
+      phonemes.push_back(std::string(st));
+      s = s.substr(ei);
     }
   }
   void splitIntoPhonemes(
@@ -84,38 +90,218 @@ namespace sca {
     id = it - instanceNames.begin();
     return ErrorCode::ok;
   }
-  bool SoundChange::apply(
-      const SCA& sca, WString& st, const std::string& pos) const {
+  thread_local Limit limitReached = Limit::none;
+  thread_local size_t replacementsLeft = -1;
+  thread_local size_t maxWordSize = -1;
+  static void count(RuleProfile& prof, const std::optional<size_t>& res) {
+    ++prof.candidates;
+    if (res.has_value()) ++prof.replacements;
+  }
+  // Let a sound change that has made `n` replacements so far make another
+  // one only if that keeps it within the limit.
+  static void allowReplacements(const SCA& sca, size_t n) {
+    size_t maxReplacements = sca.getLimits().replacements;
+    replacementsLeft = (maxReplacements != 0) ? maxReplacements - n : -1;
+  }
+  bool SoundChange::apply(const SCA& sca, WString& st, size_t maxSize) const {
+    TraceSpan span("rule", rule.get());
     bool matched = false;
-    if (!poses.empty() && poses.count(pos) == 0) return false;
+    size_t n = 0;
+    RuleProfile* prof = currentRuleProfile;
+    // A sound change that keeps going after a replacement can edit a long
+    // word many times, so keep the gap in the word at the cursor until
+    // it's done.
+    bool gap = opt.beh != Behaviour::once;
+    maxWordSize = maxSize;
     if (opt.eo == EvaluationOrder::ltr) {
-      size_t i = 0;
+      // Skip straight to the positions where the rule could match at all
+      // (this matters for rules anchored to the edge of the word).
+      size_t i = rule->nextCandidateLTR(st, 0);
       // `<=` is intentional. We allow matching one character past the end
       // to allow epenthesis rules such as the following:
       // -> i (t _ ~);
       while (i <= st.size()) {
+        allowReplacements(sca, n);
+        if (gap) st.moveGap(i);
         auto res = rule->tryReplaceLTR(sca, st, i);
-        if (res.has_value()) matched = true;
+        if (prof != nullptr) count(*prof, res);
+        if (limitReached != Limit::none) break;
+        if (res.has_value()) {
+          matched = true;
+          ++n;
+        }
         if (res.has_value() && opt.beh == Behaviour::once) break;
         if (opt.beh == Behaviour::loopnsi && res.has_value()) i += *res;
         else ++i;
+        if (gap) st.moveGap(std::min(i, st.size()));
+        i = rule->nextCandidateLTR(st, i);
       }
     } else {
-      size_t i = 0;
+      size_t i = rule->nextCandidateRTL(st, 0);
       while (i <= st.size()) {
+        allowReplacements(sca, n);
+        // `i` is counted from the end here.
+        if (gap) st.moveGap(st.size() - i);
         auto res = rule->tryReplaceRTL(sca, st, i);
-        if (res.has_value()) matched = true;
+        if (prof != nullptr) count(*prof, res);
+        if (limitReached != Limit::none) break;
+        if (res.has_value()) {
+          matched = true;
+          ++n;
+        }
         if (res.has_value() && opt.beh == Behaviour::once) break;
         if (opt.beh == Behaviour::loopnsi && res.has_value()) i += *res;
         else ++i;
+        if (gap) st.moveGap(st.size() - std::min(i, st.size()));
+        i = rule->nextCandidateRTL(st, i);
       }
     }
+    if (gap) st.closeGap();
+    replacementsLeft = -1;
+    maxWordSize = -1;
     return matched;
   }
+  // Run several sound changes that can't affect each other (see
+  // SCA::fuseRules) in a single scan of the word. They all have the same
+  // evaluation order and don't change the length of the word (so they can't
+  // reach the growth limit), and each one keeps its own position in the
+  // same way as SoundChange::apply would. If one of them reaches a limit,
+  // return it.
+  //
+  // When profiling, each attempt is counted and timed for the sound change
+  // that made it, but moving from one position to the next isn't.
+  const SoundChange* SCA::applyFused(
+      const size_t* ris, size_t n, WString& st) const {
+    TraceSpan span("fused rules", rules[ris[0]].rule.get());
+    assert(n <= MAX_FUSED);
+    Profile* prof = activeProfile;
+    bool ltr = rules[ris[0]].opt.eo == EvaluationOrder::ltr;
+    size_t size = st.size();
+    size_t cursors[MAX_FUSED], replacements[MAX_FUSED] = {};
+    for (size_t k = 0; k < n; ++k) {
+      const Rule& rule = *rules[ris[k]].rule;
+      cursors[k] = ltr ?
+        rule.nextCandidateLTR(st, 0) : rule.nextCandidateRTL(st, 0);
+    }
+    while (true) {
+      size_t i = *std::min_element(cursors, cursors + n);
+      if (i > size) break;
+      for (size_t k = 0; k < n; ++k) {
+        if (cursors[k] != i) continue;
+        const SoundChange& sc = rules[ris[k]];
+        allowReplacements(*this, replacements[k]);
+        auto start = ProfileClock::time_point();
+        if (prof != nullptr) {
+          currentRuleProfile = &prof->rules[ris[k]];
+          start = ProfileClock::now();
+        }
+        auto res = ltr ?
+          sc.rule->tryReplaceLTR(*this, st, i) :
+          sc.rule->tryReplaceRTL(*this, st, i);
+        replacementsLeft = -1;
+        if (prof != nullptr) {
+          currentRuleProfile->ns += nsSince(start);
+          count(*currentRuleProfile, res);
+          currentRuleProfile = nullptr;
+        }
+        if (limitReached != Limit::none) return &sc;
+        if (res.has_value()) ++replacements[k];
+        if (res.has_value() && sc.opt.beh == Behaviour::once) {
+          cursors[k] = -1;
+          continue;
+        }
+        bool skip = sc.opt.beh == Behaviour::loopnsi && res.has_value();
+        size_t next = skip ? i + *res : i + 1;
+        cursors[k] = ltr ?
+          sc.rule->nextCandidateLTR(st, next) :
+          sc.rule->nextCandidateRTL(st, next);
+      }
+    }
+    return nullptr;
+  }
+  // Report that `sc` reached the limit in limitReached, and clear it.
+  void SCA::reportLimit(
+      const SoundChange& sc, const WString& st,
+      std::vector<Error>* errors) const {
+    Limit l = limitReached;
+    limitReached = Limit::none;
+    if (errors == nullptr) return;
+    std::string what;
+    switch (l) {
+      case Limit::replacements:
+        what = "more than " + std::to_string(limits.replacements) +
+          " replacements";
+        break;
+      case Limit::growth:
+        what = "grew by more than " + std::to_string(limits.growth) +
+          " phonemes";
+        break;
+      case Limit::matchSteps:
+        what = "matching took more than " +
+          std::to_string(limits.matchSteps) + " steps";
+        break;
+      case Limit::matchDepth:
+        what = "matching recursed more than " +
+          std::to_string(MAX_MATCH_DEPTH) + " levels deep";
+        break;
+      case Limit::luaInstructions:
+        what = "Γ ran more than " + std::to_string(limits.luaInstructions) +
+          " instructions";
+        break;
+      case Limit::none: return;
+    }
+    const Rule& r = *sc.rule;
+    errors->push_back(
+      (ErrorCode::wordLimitReached %
+        (what + "; stopped at " + wStringToString(st))).at(r.line, r.col));
+  }
   SCA::SCA() :
       phonemesReverse(16, PSHash{this}, PSEqual{this}),
-      luaState(luaL_newstate(), &lua_close) {
-    luaL_openlibs(luaState.get());
+      luaState(nullptr, &lua_close) {}
+  void SCA::insertSoundChange(SoundChange&& sc) {
+    size_t ri = rules.size();
+    if (sc.poses.empty()) {
+      unrestrictedRules.push_back(ri);
+      for (std::vector<size_t>& l : rulesByPOS) l.push_back(ri);
+    } else {
+      for (size_t pos : sc.poses) rulesByPOS[pos].push_back(ri);
+    }
+    rules.push_back(std::move(sc));
+  }
+  Error SCA::insertCheckpoint(std::string&& name, size_t line, size_t col) {
+    size_t old = getCheckpointByName(name);
+    if (old != -1) {
+      const Checkpoint& c = checkpoints[old];
+      return (ErrorCode::checkpointExists % name).at(c.line, c.col);
+    }
+    checkpoints.push_back({std::move(name), rules.size(), line, col});
+    return ErrorCode::ok;
+  }
+  size_t SCA::getCheckpointByName(const std::string& name) const {
+    for (size_t i = 0; i < checkpoints.size(); ++i)
+      if (checkpoints[i].name == name) return i;
+    return -1;
+  }
+  bool SCA::hasCheckpointBetween(size_t a, size_t b) const {
+    for (const Checkpoint& c : checkpoints)
+      if (c.position > a && c.position <= b) return true;
+    return false;
+  }
+  Error SCA::setSyllabifier(Syllabifier&& syl) {
+    if (syllabifier.has_value()) return ErrorCode::syllablesExist;
+    syllabifier = std::move(syl);
+    lastDeclaration = rules.size();
+    return ErrorCode::ok;
+  }
+  size_t SCA::internPOS(const std::string& name) {
+    auto res = posesByName.try_emplace(name, posNames.size());
+    if (res.second) {
+      posNames.push_back(name);
+      // A part of speech seen for the first time is still subject to
+      // all of the unrestricted sound changes before it.
+      rulesByPOS.push_back(unrestrictedRules);
+    }
+    return res.first->second;
   }
   Error SCA::insertFeature(
       Feature&& f, const PhonemesByFeature& phonemesByFeature) {
@@ -127,6 +313,7 @@ namespace sca {
       return (ErrorCode::featureExists % f.featureName).at(old.line, old.col);
     }
     features.push_back(std::move(f));
+    lastDeclaration = rules.size();
     for (size_t ii = 0; ii < phonemesByFeature.size(); ++ii) {
       const std::vector<std::string>& phonemesInInstance =
         phonemesByFeature[ii];
@@ -148,22 +335,19 @@ namespace sca {
       const CharClass& old = charClasses[res.first->second];
       return (ErrorCode::classExists % name).at(old.line, old.col);
     }
-    for (const std::string& phoneme : myPhonemes) {
-      PhonemeSpec& spec = phonemes[phoneme];
-      if (spec.charClass != -1)
-        return ErrorCode::phonemeAlreadyHasClass %
-          (phoneme + " is in " + charClasses[spec.charClass].name +
-            "; tried to insert it in " + name);
-      if (spec.name.empty()) spec.name = phoneme;
-    }
     charClasses.emplace_back();
+    lastDeclaration = rules.size();
     CharClass& newClass = charClasses.back();
     newClass.name = std::move(name);
     newClass.line = line;
     newClass.col = col;
+    // Phonemes can be in any number of classes.
     for (const std::string& phoneme : myPhonemes) {
       PhonemeSpec& spec = phonemes[phoneme];
-      spec.charClass = oldClassCount;
+      if (spec.name.empty()) spec.name = phoneme;
+      if (spec.charClass == -1) spec.charClass = oldClassCount;
+      spec.classes.resize(oldClassCount + 1);
+      spec.classes.set(oldClassCount);
     }
     return ErrorCode::ok;
   }
@@ -205,61 +389,243 @@ namespace sca {
       const std::string& name, PhonemeSpec*& ps) {
     return getPhonemeByName(name, (const PhonemeSpec*&) ps);
   }
-  void SCA::verify(std::vector<Error>& errors) const {
-    for (const SoundChange& sc : rules) {
+  void SCA::verify(std::vector<Error>& errors) {
+    for (SoundChange& sc : rules) {
       sc.rule->verify(errors, *this, sc);
     }
   }
   void SCA::reversePhonemeMap() {
-    for (const auto& p : phonemes) {
+    // Number the phonemes in name order so that IDs don't depend on the
+    // iteration order of the hash map.
+    phonemesByID.clear();
+    for (const auto& p : phonemes) phonemesByID.push_back(&p.second);
+    std::sort(phonemesByID.begin(), phonemesByID.end(),
+      [](const PhonemeSpec* a, const PhonemeSpec* b) {
+        return a->name < b->name;
+      });
+    longestPhonemeName = 0;
+    for (size_t i = 0; i < phonemesByID.size(); ++i) {
+      phonemes[phonemesByID[i]->name].id = i;
+      longestPhonemeName =
+        std::max(longestPhonemeName, phonemesByID[i]->name.size());
+    }
+    for (auto& p : phonemes) {
+      p.second.fillFeatureValues(*this);
       phonemesReverse.insert(std::pair(p.second, p.first));
     }
+    for (SoundChange& sc : rules) sc.rule->classify(*this);
+    if (syllabifier.has_value()) {
+      syllabifier->compile(*this);
+      for (const SoundChange& sc : rules) {
+        auto [srs, n] = sc.rule->getSimpleRules();
+        for (size_t i = 0; i < n; ++i) {
+          for (const NativeCondition& nc : srs[i].conditions)
+            if (nc.isSyllabic()) tracksSyllables = true;
+        }
+      }
+    }
+    // Create the phonemes that ω can insert without them being in the
+    // inventory once, rather than every time they're inserted.
+    for (const SoundChange& sc : rules) {
+      auto [srs, n] = sc.rule->getSimpleRules();
+      for (size_t i = 0; i < n; ++i) {
+        for (const MChar& c : srs[i].omega) {
+          if (!c.is<std::string>()) continue;
+          const std::string& name = c.as<std::string>();
+          if (phonemes.count(name) != 0) continue;
+          PhonemeSpec& stray = strayPhonemes.try_emplace(name).first->second;
+          stray.name = name;
+          stray.fillFeatureValues(*this);
+        }
+      }
+    }
   }
-  std::string SCA::apply(
-      const std::string_view& st,
-      const std::string& pos,
-      bool verbose) const {
+  WString SCA::tokenize(const std::string_view& st) const {
     // Split into phonemes
-    MString ms;
-    splitIntoPhonemes(*this, st, ms);
+    ScratchVector<std::string> ms;
+    splitIntoPhonemes(*this, st, ms, longestPhonemeName);
     // Map to actual PhonemeSpec objects
     WString ws;
-    for (const MChar& ch : ms) {
+    ws.reserve(ms.size());
+    for (std::string& ch : ms) {
       const PhonemeSpec* ps;
-      assert(ch.is<std::string>());
-      auto res = getPhonemeByName(ch.as<std::string>(), ps);
+      auto res = getPhonemeByName(ch, ps);
       if (res.ok()) {
         ws.push_back(makePObserver(*ps));
       } else {
         // None found; create a temporary
         // (would have liked to cache this but this method is const)
         auto ps2 = makePOwner<PhonemeSpec>();
-        ps2->name = std::move(ch.as<std::string>());
+        ps2->name = std::move(ch);
         ws.push_back(makeConst(std::move(ps2)));
       }
     }
+    return ws;
+  }
+  // Makes currentSyllables point to a word's syllables while it exists.
+  class SyllablesScope {
+  public:
+    SyllablesScope(Syllables* syl) : previous(currentSyllables) {
+      currentSyllables = syl;
+    }
+    ~SyllablesScope() { currentSyllables = previous; }
+  private:
+    Syllables* previous;
+  };
+  void SCA::applySoundChanges(
+      WString& ws, const std::string& pos, bool verbose,
+      std::vector<Error>* errors, std::vector<std::string>* stages) const {
+    applyRange(ws, pos, 0, -1, ws.size(), verbose, errors, stages);
+  }
+  bool SCA::applySoundChangeRange(
+      WString& ws, const std::string& pos, size_t first, size_t last,
+      size_t inputSize, bool verbose, std::vector<Error>* errors) const {
+    return applyRange(
+      ws, pos, first, last, inputSize, verbose, errors, nullptr);
+  }
+  bool SCA::applyRange(
+      WString& ws, const std::string& pos, size_t first, size_t last,
+      size_t inputSize, bool verbose, std::vector<Error>* errors,
+      std::vector<std::string>* stages) const {
     // std::cerr << wStringToString(ws) << "\n";
+    size_t posID = getPOSByName(pos);
+    const std::vector<size_t>& active =
+      (posID != -1) ? rulesByPOS[posID] : unrestrictedRules;
+    const std::vector<size_t>& passEnds =
+      (posID != -1 && !passesByPOS.empty()) ? passesByPOS[posID] :
+      unrestrictedPasses;
+    Profile* prof = activeProfile;
     std::string s;
-    for (const SoundChange& r : rules) {
+    size_t maxSize = (limits.growth != 0) ? inputSize + limits.growth : -1;
+    std::optional<Syllables> syllables;
+    if (tracksSyllables) syllables.emplace(*this, *syllabifier, ws);
+    SyllablesScope syllablesScope(syllables ? &*syllables : nullptr);
+    if (stages != nullptr) stages->assign(checkpoints.size(), std::string());
+    size_t nextCheckpoint = 0;
+    // Record the word at the checkpoints before sound change `ri`.
+    auto reachCheckpoints = [&](size_t ri) {
+      if (stages == nullptr) return;
+      for (; nextCheckpoint < checkpoints.size() &&
+          checkpoints[nextCheckpoint].position <= ri; ++nextCheckpoint)
+        (*stages)[nextCheckpoint] = wStringToString(ws);
+    };
+    size_t begin =
+      std::lower_bound(active.begin(), active.end(), first) - active.begin();
+    size_t stop =
+      std::lower_bound(active.begin(), active.end(), last) - active.begin();
+    // Start from the pass that `begin` is in. If it's in the middle of one,
+    // then the rest of that pass is still safe to fuse.
+    size_t pi = 0;
+    while (pi < passEnds.size() && passEnds[pi] <= begin) ++pi;
+    bool stopped = false;
+    while (begin < stop) {
+      reachCheckpoints(active[begin]);
+      // In verbose mode, run each sound change separately so that we can
+      // show what each one did.
+      size_t end = (verbose || pi >= passEnds.size()) ?
+        begin + 1 : std::min(passEnds[pi++], stop);
+      if (end - begin > 1) {
+        const SoundChange* sc =
+          applyFused(&active[begin], end - begin, ws);
+        if (sc != nullptr) {
+          reportLimit(*sc, ws, errors);
+          stopped = true;
+          break;
+        }
+        begin = end;
+        continue;
+      }
+      const SoundChange& r = rules[active[begin]];
       if (verbose) {
         s = wStringToString(ws);
       }
-      bool matched = r.apply(*this, ws, pos);
+      auto start = ProfileClock::time_point();
+      if (prof != nullptr) {
+        currentRuleProfile = &prof->rules[active[begin]];
+        start = ProfileClock::now();
+      }
+      bool matched = r.apply(*this, ws, maxSize);
+      if (prof != nullptr) {
+        currentRuleProfile->ns += nsSince(start);
+        currentRuleProfile = nullptr;
+      }
       if (verbose && matched) {
         std::cerr << s << " -> " << wStringToString(ws) << "\n";
       }
+      if (limitReached != Limit::none) {
+        reportLimit(r, ws, errors);
+        stopped = true;
+        break;
+      }
       // std::cerr << "-> " << wStringToString(ws) << "\n";
+      begin = end;
+    }
+    // The rest of the checkpoints, including any after a limit was reached
+    reachCheckpoints(-1);
+    return !stopped;
+  }
+  std::string SCA::apply(
+      const std::string_view& st,
+      const std::string& pos,
+      bool verbose,
+      std::vector<Error>* errors,
+      std::vector<std::string>* stages) const {
+    TraceSpan span("word");
+    Profile* prof = activeProfile;
+    uint64_t allocs = allocationCount;
+    std::string res;
+    {
+      ArenaScope scratch;
+      WString ws = tokenize(st);
+      applySoundChanges(ws, pos, verbose, errors, stages);
+      res = wStringToString(ws);
     }
-    return wStringToString(ws);
+    if (prof != nullptr) {
+      ++prof->words;
+      prof->allocations += allocationCount - allocs;
+    }
+    return res;
+  }
+  void SCA::setLimits(const WordLimits& l) {
+    limits = l;
+#ifdef SCA_LUAJIT
+    // Compiled code doesn't call the hook that enforces the instruction
+    // limit, so stick to the interpreter when there is one.
+    if (luaState != nullptr)
+      luaJIT_setmode(luaState.get(), 0, LUAJIT_MODE_ENGINE |
+        (limits.luaInstructions != 0 ? LUAJIT_MODE_OFF : LUAJIT_MODE_ON));
+#endif
+  }
+  lua_State* SCA::requireLuaState() {
+    if (luaState != nullptr) return luaState.get();
+    TraceSpan span("Lua state");
+    luaState.reset(luaL_newstate());
+    lua_State* l = luaState.get();
+    luaL_openlibs(l);
+    sca::lua::init(l);
+    lua_settop(l, 0);
+    sca::lua::pushSCA(l, *this);
+    lua_setglobal(l, "sca");
+    setLimits(limits);
+    return l;
   }
   void SCA::addGlobalLuaCode(const LuaCode& lc) {
+    requireLuaState();
     globalLuaCode += lc.code;
+    lastDeclaration = rules.size();
+  }
+  bool SCA::usesLua() const {
+    if (luaState == nullptr) return false;
+    if (!globalLuaCode.empty()) return true;
+    for (const SoundChange& sc : rules) {
+      auto [srs, n] = sc.rule->getSimpleRules();
+      for (size_t i = 0; i < n; ++i)
+        if (srs[i].gammaref != LUA_NOREF) return true;
+    }
+    return false;
   }
   std::string SCA::executeGlobalLuaCode() {
     if (globalLuaCode.empty()) return "";
-    sca::lua::init(luaState.get());
-    sca::lua::pushSCA(luaState.get(), *this);
-    lua_setglobal(luaState.get(), "sca");
     int stat = luaL_loadbufferx(
       luaState.get(),
       globalLuaCode.c_str(), globalLuaCode.size(),
@@ -0,0 +1,171 @@
+#include "WString.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "Rule.h"
+
+/*
+  A PUnique is just a pointer and a flag, so moving one to another place
+  in memory and forgetting about the original is the same as copying its
+  bytes. We take advantage of that to move runs of elements with memmove.
+*/
+
+namespace sca {
+  using Elem = WString::value_type;
+  static void relocate(Elem* dst, Elem* src, size_t count) {
+    memmove((void*) dst, (const void*) src, count * sizeof(Elem));
+  }
+  WString::WString(WString&& other) noexcept :
+      buf(inlineBuffer()), alloc(other.alloc) {
+    head = other.head;
+    n = other.n;
+    gapAt = other.gapAt;
+    gapLen = other.gapLen;
+    keepGap = other.keepGap;
+    if (other.isInline()) {
+      relocate(buf + head, other.buf + head, n + gapLen);
+    } else {
+      buf = other.buf;
+      cap = other.cap;
+      other.buf = other.inlineBuffer();
+      other.cap = INLINE_CAPACITY;
+    }
+    other.head = other.n = other.gapAt = other.gapLen = 0;
+    other.keepGap = false;
+  }
+  WString& WString::operator=(WString&& other) noexcept {
+    if (this == &other) return *this;
+    this->~WString();
+    new (this) WString(std::move(other));
+    return *this;
+  }
+  WString::~WString() {
+    destroy(0, n);
+    if (!isInline()) alloc.deallocate(buf, cap);
+  }
+  void WString::destroy(size_t b, size_t e) {
+    for (size_t i = b; i < e; ++i) buf[head + physical(i)].~Elem();
+  }
+  void WString::resize(size_t m) {
+    if (m < n) {
+      destroy(m, n);
+    } else if (m > n) {
+      reserve(m);
+      for (size_t i = n; i < m; ++i) new (buf + head + i) Elem();
+    }
+    n = m;
+  }
+  void WString::makeRoomAtEnd(size_t k) {
+    if (n + k <= cap) {
+      // Use the room at the start instead.
+      relocate(buf, buf + head, n);
+      head = 0;
+      return;
+    }
+    reallocate(std::max(2 * cap, n + k), 0, n, 0, 0);
+  }
+  Elem* WString::makeRoom(size_t b, size_t e, size_t k) {
+    destroy(b, e);
+    size_t d = e - b;
+    size_t left = b, right = n - e;
+    if (k > d) {
+      size_t g = k - d;
+      bool canLeft = head >= g;
+      bool canRight = head + n + g <= cap;
+      if (canLeft && (left < right || !canRight)) {
+        relocate(buf + head - g, buf + head, left);
+        head -= g;
+      } else if (canRight) {
+        relocate(buf + head + e + g, buf + head + e, right);
+      } else {
+        // Leave some room on both sides for later edits.
+        size_t newCap = std::max(2 * cap, n + g);
+        reallocate(newCap, (newCap - n - g) / 2, b, d, k);
+        n += g;
+        return buf + head + b;
+      }
+      n += g;
+    } else if (k < d) {
+      size_t g = d - k;
+      if (left < right) {
+        relocate(buf + head + g, buf + head, left);
+        head += g;
+      } else {
+        relocate(buf + head + b + k, buf + head + e, right);
+      }
+      n -= g;
+    }
+    return buf + head + b;
+  }
+  Elem* WString::fillGap(size_t b, size_t e, size_t k) {
+    moveGap(b);
+    destroy(b, e);
+    gapLen += e - b;
+    n -= e - b;
+    if (gapLen < k) growGap(k);
+    Elem* p = buf + head + gapAt;
+    gapAt += k;
+    gapLen -= k;
+    n += k;
+    return p;
+  }
+  void WString::growGap(size_t k) {
+    // Either way, this moves every element, so make sure that the gap is
+    // then long enough for a proportional number of insertions.
+    size_t right = n - gapAt;
+    Elem* src = buf + head;
+    Elem* newBuf = buf;
+    size_t newCap = cap;
+    if (cap - n < k + n / 2) {
+      newCap = std::max(2 * cap, 2 * n + k);
+      newBuf = alloc.allocate(newCap);
+    }
+    relocate(newBuf, src, gapAt);
+    relocate(newBuf + newCap - right, src + gapAt + gapLen, right);
+    if (newBuf != buf) {
+      if (!isInline()) alloc.deallocate(buf, cap);
+      buf = newBuf;
+      cap = newCap;
+    }
+    head = 0;
+    gapLen = cap - n;
+  }
+  void WString::moveGap(size_t i) {
+    keepGap = true;
+    if (gapLen > 0) {
+      Elem* p = buf + head;
+      if (i < gapAt) {
+        relocate(p + i + gapLen, p + i, gapAt - i);
+      } else if (i > gapAt) {
+        relocate(p + gapAt, p + gapAt + gapLen, i - gapAt);
+      }
+    }
+    gapAt = i;
+  }
+  void WString::closeGap() {
+    keepGap = false;
+    if (gapLen > 0) {
+      // Move whichever side is shorter.
+      if (gapAt < n - gapAt) {
+        relocate(buf + head + gapLen, buf + head, gapAt);
+        head += gapLen;
+      } else {
+        relocate(buf + head + gapAt, buf + head + gapAt + gapLen, n - gapAt);
+      }
+    }
+    gapAt = gapLen = 0;
+  }
+  void WString::reallocate(
+      size_t newCap, size_t newHead, size_t at, size_t removed, size_t gap) {
+    Elem* newBuf = alloc.allocate(newCap);
+    relocate(newBuf + newHead, buf + head, at);
+    relocate(newBuf + newHead + at + gap, buf + head + at + removed,
+      n - at - removed);
+    if (!isInline()) alloc.deallocate(buf, cap);
+    buf = newBuf;
+    cap = newCap;
+    head = newHead;
+  }
+}
@@ -0,0 +1,86 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+#include "load.h"
+
+namespace sca {
+  // The number of words that a thread takes at a time
+  static constexpr size_t BATCH_CHUNK = 64;
+  std::unique_ptr<ScriptPool> ScriptPool::load(std::string source) {
+    std::istringstream in(source);
+    std::unique_ptr<SCA> sca = loadScript(in);
+    if (sca == nullptr) return nullptr;
+    std::unique_ptr<ScriptPool> pool(new ScriptPool());
+    pool->source = std::move(source);
+    pool->limits = sca->getLimits();
+    pool->usesLua = sca->usesLua();
+    pool->scas.push_back(std::move(sca));
+    return pool;
+  }
+  void ScriptPool::setLimits(const WordLimits& l) {
+    std::lock_guard<std::mutex> guard(lock);
+    limits = l;
+    for (auto& sca : scas) sca->setLimits(l);
+  }
+  std::string ScriptPool::apply(
+      const std::string_view& word, const std::string& pos,
+      std::vector<Error>* errors) const {
+    if (!usesLua) return scas[0]->apply(word, pos, false, errors);
+    std::lock_guard<std::mutex> guard(lock);
+    return scas[0]->apply(word, pos, false, errors);
+  }
+  size_t ScriptPool::reserveCopies(size_t n) {
+    if (!usesLua) return n;
+    while (scas.size() < n) {
+      std::istringstream in(source);
+      std::unique_ptr<SCA> sca = loadScript(in);
+      if (sca == nullptr) break;
+      sca->setLimits(limits);
+      scas.push_back(std::move(sca));
+    }
+    return std::min(n, scas.size());
+  }
+  void ScriptPool::applyBatch(
+      const std::vector<std::string>& words,
+      const std::vector<std::string>& poses,
+      std::vector<std::string>& out,
+      std::vector<std::vector<Error>>* errors,
+      size_t nThreads) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (nThreads == 0) nThreads = std::thread::hardware_concurrency();
+    // No point in having threads that won't get any words
+    nThreads = std::min(
+      nThreads, (words.size() + BATCH_CHUNK - 1) / BATCH_CHUNK);
+    nThreads = std::max<size_t>(nThreads, 1);
+    nThreads = reserveCopies(nThreads);
+    out.clear();
+    out.resize(words.size());
+    if (errors != nullptr) {
+      errors->clear();
+      errors->resize(words.size());
+    }
+    static const std::string noPOS;
+    std::atomic<size_t> next(0);
+    auto work = [&](const SCA& sca) {
+      while (true) {
+        size_t begin = next.fetch_add(BATCH_CHUNK);
+        if (begin >= words.size()) return;
+        size_t end = std::min(begin + BATCH_CHUNK, words.size());
+        for (size_t i = begin; i < end; ++i) {
+          out[i] = sca.apply(
+            words[i], poses.empty() ? noPOS : poses[i], false,
+            errors != nullptr ? &(*errors)[i] : nullptr);
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < nThreads; ++i)
+      threads.emplace_back(work, std::cref(*scas[usesLua ? i : 0]));
+    work(*scas[0]);
+    for (std::thread& t : threads) t.join();
+  }
+}
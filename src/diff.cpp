@@ -0,0 +1,94 @@
+#include "diff.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "trace.h"
+
+namespace sca {
+  // Do the scripts have the same phonemes, with the same IDs?
+  static bool haveSameInventory(const SCA& a, const SCA& b) {
+    if (a.getPhonemeCount() != b.getPhonemeCount()) return false;
+    for (size_t id = 0; id < a.getPhonemeCount(); ++id) {
+      if (a.getPhonemeByID(id).name != b.getPhonemeByID(id).name)
+        return false;
+    }
+    return true;
+  }
+  static size_t countSharedSoundChanges(
+      const SCA& a, const std::string& aSource,
+      const SCA& b, const std::string& bSource) {
+    if (a.usesLua() || b.usesLua() || !haveSameInventory(a, b)) return 0;
+    if (aSource == bSource) return a.getSoundChangeCount();
+    // Find where the scripts start to differ, as a line and column
+    size_t d = std::mismatch(
+      aSource.begin(), aSource.end(), bSource.begin(), bSource.end())
+      .first - aSource.begin();
+    size_t line = std::count(aSource.begin(), aSource.begin() + d, '\n');
+    size_t nl = (d == 0) ? std::string::npos : aSource.rfind('\n', d - 1);
+    size_t col = (nl == std::string::npos) ? d : d - nl - 1;
+    // Count the sound changes that start before that point. The position
+    // of a sound change is where the lexer was when the parser got to it,
+    // which is past the end of everything before it, so all but the last
+    // of these are certain to be the same in both scripts.
+    auto countBefore = [&](const SCA& sca) {
+      size_t n = 0;
+      for (; n < sca.getSoundChangeCount(); ++n) {
+        const Rule& r = *sca.getSoundChange(n).rule;
+        if (std::pair(r.line, r.col) >= std::pair(line, col)) break;
+      }
+      return n;
+    };
+    size_t n = countBefore(a);
+    if (n == 0 || countBefore(b) != n) return 0;
+    // Each script's declarations have to be finished by then as well.
+    if (a.getLastDeclaration() >= n || b.getLastDeclaration() >= n) return 0;
+    return n - 1;
+  }
+  ScriptDiff::ScriptDiff(
+      std::unique_ptr<SCA>&& oldSCA, const std::string& oldSource,
+      std::unique_ptr<SCA>&& newSCA, const std::string& newSource) :
+      oldSCA(std::move(oldSCA)), newSCA(std::move(newSCA)) {
+    shared = countSharedSoundChanges(
+      *this->oldSCA, oldSource, *this->newSCA, newSource);
+  }
+  WString ScriptDiff::fork(const WString& ws) const {
+    WString res;
+    res.reserve(ws.size());
+    for (const auto& p : ws) {
+      if (p->id != -1 && p.get() == &oldSCA->getPhonemeByID(p->id)) {
+        res.push_back(makePObserver(newSCA->getPhonemeByID(p->id)));
+        continue;
+      }
+      const PhonemeSpec* stray = newSCA->getStrayPhoneme(p->name);
+      if (stray != nullptr && p.get() == oldSCA->getStrayPhoneme(p->name))
+        res.push_back(makePObserver(*stray));
+      else
+        res.push_back(makeConst(makePOwner<PhonemeSpec>(*p)));
+    }
+    return res;
+  }
+  bool ScriptDiff::apply(
+      const std::string_view& st, const std::string& pos,
+      std::string& oldOut, std::string& newOut, bool verbose,
+      std::vector<Error>* errors) const {
+    TraceSpan span("word");
+    ArenaScope scratch;
+    WString ws = oldSCA->tokenize(st);
+    size_t inputSize = ws.size();
+    if (!oldSCA->applySoundChangeRange(
+        ws, pos, 0, shared, inputSize, verbose, errors)) {
+      // Both scripts would have stopped here.
+      oldOut = newOut = oldSCA->wStringToString(ws);
+      return false;
+    }
+    WString other = (shared != 0) ? fork(ws) : newSCA->tokenize(st);
+    oldSCA->applySoundChangeRange(
+      ws, pos, shared, -1, inputSize, verbose, errors);
+    newSCA->applySoundChangeRange(
+      other, pos, shared, -1, inputSize, verbose, errors);
+    oldOut = oldSCA->wStringToString(ws);
+    newOut = newSCA->wStringToString(other);
+    return oldOut != newOut;
+  }
+}
@@ -25,6 +25,12 @@ namespace sca {
     "Alternation or repetition found in ω",
     "Ordered constraint operator on unordered feature",
     "Dependent constraint was not previously defined",
+    "Constraint in a group refers to another matcher",
+    "Constraint group found in ω",
+    "Limit reached while applying sound changes",
+    "Syllables already declared",
+    "Syllable condition used without a syllables declaration",
+    "Checkpoint already exists",
   };
   const char* stringError(ErrorCode ec) {
     int n = (int) ec;
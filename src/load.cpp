@@ -0,0 +1,41 @@
+#include "load.h"
+
+#include <iostream>
+
+#include "Lexer.h"
+#include "Parser.h"
+#include "trace.h"
+
+namespace sca {
+  std::unique_ptr<SCA> loadScript(
+      std::istream& in, std::vector<DeadRule>* dead) {
+    auto sca = std::make_unique<SCA>();
+    Lexer lexer(&in);
+    Parser parser(&lexer, sca.get());
+    {
+      TraceSpan span("parse");
+      if (!parser.parse()) return nullptr;
+    }
+    {
+      TraceSpan span("verify");
+      std::vector<Error> errors;
+      sca->verify(errors);
+      for (const Error& e : errors) printError(e);
+      if (!errors.empty()) return nullptr;
+      sca->reversePhonemeMap();
+      std::vector<DeadRule> ignored;
+      sca->eliminateDeadRules(dead != nullptr ? *dead : ignored);
+      sca->fuseRules();
+    }
+    std::string err;
+    {
+      TraceSpan span("Lua init");
+      err = sca->executeGlobalLuaCode();
+    }
+    if (!err.empty()) {
+      std::cerr << err;
+      return nullptr;
+    }
+    return sca;
+  }
+}
@@ -0,0 +1,257 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "SCA.h"
+#include "batch.h"
+#include "lua_compat.h"
+
+/*
+  The `zt` module, for using ztš from Lua programs:
+
+    local zt = require "zt"
+    local script = assert(zt.load("7_1_1.zt"))
+    print(script:apply("word"))
+    local outs, errs = script:applyBatch({"word", "other"}, "n")
+
+  Lua errors are raised with longjmp, so nothing here may raise one while
+  an object with a destructor is alive. Even pushing a string raises an
+  error if memory runs out, so results that are held in C++ objects are
+  pushed in protected mode (see callProtected).
+*/
+
+namespace sca::lua {
+  static constexpr const char* SCRIPT_METATABLE_NAME = "zt.Script";
+  static ScriptPool* checkScript(lua_State* l, int index) {
+    void* ud = luaL_checkudata(l, index, SCRIPT_METATABLE_NAME);
+    ScriptPool* pool = *(ScriptPool**) ud;
+    luaL_argcheck(l, pool != nullptr, index, "script has been freed");
+    return pool;
+  }
+  // Push a script object with no script in it yet. It's made before the
+  // script is loaded, so that the script can't be leaked if this fails.
+  static ScriptPool** newScript(lua_State* l) {
+    ScriptPool** ud = (ScriptPool**) lua_newuserdata(l, sizeof(ScriptPool*));
+    *ud = nullptr;
+    luaL_getmetatable(l, SCRIPT_METATABLE_NAME);
+    lua_setmetatable(l, -2);
+    return ud;
+  }
+  // The function below the top of the stack was pushed before any C++
+  // objects were made, since pushing it might raise an error. Call it in
+  // protected mode with `data` as a light userdata, and return the status.
+  // If it failed, then the caller should let its objects go out of scope
+  // and raise the error (which is on the stack) again.
+  static int callProtected(lua_State* l, void* data, int nResults) {
+    lua_pushlightuserdata(l, data);
+    return lua_pcall(l, 1, nResults, 0);
+  }
+  // The errors for a word, one per line
+  static std::string errorsAsString(const std::vector<Error>& errors) {
+    std::string s;
+    for (const Error& e : errors) s += errorAsString(e);
+    if (!s.empty()) s.pop_back(); // the last newline
+    return s;
+  }
+  // Push a word's errors, or nil if it had none.
+  static void pushErrors(lua_State* l, const std::string& errors) {
+    if (errors.empty()) lua_pushnil(l);
+    else lua_pushlstring(l, errors.data(), errors.size());
+  }
+  // script, err = zt.loadString(source)
+  static int ztLoadString(lua_State* l) {
+    size_t len;
+    const char* s = luaL_checklstring(l, 1, &len);
+    ScriptPool** ud = newScript(l);
+    *ud = ScriptPool::load(std::string(s, len)).release();
+    if (*ud == nullptr) {
+      lua_pushnil(l);
+      lua_pushstring(l, "could not load script (see stderr)");
+      return 2;
+    }
+    return 1;
+  }
+  // script, err = zt.load(path)
+  static int ztLoad(lua_State* l) {
+    const char* path = luaL_checkstring(l, 1);
+    ScriptPool** ud = newScript(l);
+    bool opened;
+    {
+      std::ifstream fh(path);
+      opened = (bool) fh;
+      if (opened) {
+        std::stringstream ss;
+        ss << fh.rdbuf();
+        *ud = ScriptPool::load(ss.str()).release();
+      }
+    }
+    if (*ud == nullptr) {
+      lua_pushnil(l);
+      lua_pushfstring(l,
+        opened ? "could not load %s (see stderr)" : "could not open %s",
+        path);
+      return 2;
+    }
+    return 1;
+  }
+  struct ApplyResult {
+    std::string out, errors;
+  };
+  static int pushApplyResult(lua_State* l) {
+    const ApplyResult& r = *(const ApplyResult*) lua_touserdata(l, 1);
+    lua_pushlstring(l, r.out.data(), r.out.size());
+    pushErrors(l, r.errors);
+    return 2;
+  }
+  // output, err = script:apply(word, [pos])
+  static int scriptApply(lua_State* l) {
+    ScriptPool* pool = checkScript(l, 1);
+    size_t len;
+    const char* word = luaL_checklstring(l, 2, &len);
+    const char* pos = lua_isnoneornil(l, 3) ? "" : luaL_checkstring(l, 3);
+    lua_pushcfunction(l, pushApplyResult);
+    int status;
+    {
+      ApplyResult r;
+      std::vector<Error> errors;
+      r.out = pool->apply(std::string_view(word, len), pos, &errors);
+      r.errors = errorsAsString(errors);
+      status = callProtected(l, &r, 2);
+    }
+    if (status != LUA_OK) return lua_error(l);
+    return 2;
+  }
+  struct BatchResult {
+    std::vector<std::string> out, errors;
+  };
+  static int pushBatchResult(lua_State* l) {
+    const BatchResult& r = *(const BatchResult*) lua_touserdata(l, 1);
+    size_t n = r.out.size();
+    lua_createtable(l, (int) n, 0);
+    for (size_t i = 0; i < n; ++i) {
+      lua_pushlstring(l, r.out[i].data(), r.out[i].size());
+      lua_rawseti(l, -2, i + 1);
+    }
+    lua_newtable(l);
+    for (size_t i = 0; i < n; ++i) {
+      if (r.errors[i].empty()) continue;
+      pushErrors(l, r.errors[i]);
+      lua_rawseti(l, -2, i + 1);
+    }
+    return 2;
+  }
+  // outputs, errs = script:applyBatch(words, [pos], [threads])
+  // `pos` is either one part of speech for all of the words or a table of
+  // them. `errs` maps the indices of the words that had errors to them.
+  static int scriptApplyBatch(lua_State* l) {
+    ScriptPool* pool = checkScript(l, 1);
+    luaL_checktype(l, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(l, 2);
+    bool posTable = lua_istable(l, 3);
+    if (!posTable && !lua_isnoneornil(l, 3)) luaL_checkstring(l, 3);
+    lua_Integer nThreads =
+      lua_isnoneornil(l, 4) ? 0 : luaL_checkinteger(l, 4);
+    luaL_argcheck(l, nThreads >= 0, 4, "must not be negative");
+    // Check the types of the words first, so that no error is raised
+    // while the vectors below are alive.
+    for (size_t i = 1; i <= n; ++i) {
+      lua_rawgeti(l, 2, i);
+      bool ok = lua_type(l, -1) == LUA_TSTRING;
+      lua_pop(l, 1);
+      if (!ok) return luaL_argerror(l, 2, "words must be strings");
+      if (!posTable) continue;
+      lua_rawgeti(l, 3, i);
+      ok = lua_type(l, -1) == LUA_TSTRING || lua_isnil(l, -1);
+      lua_pop(l, 1);
+      if (!ok)
+        return luaL_argerror(l, 3, "parts of speech must be strings");
+    }
+    lua_pushcfunction(l, pushBatchResult);
+    int status;
+    {
+      BatchResult r;
+      std::vector<std::string> words(n), poses;
+      std::vector<std::vector<Error>> errors;
+      if (posTable || !lua_isnoneornil(l, 3)) poses.resize(n);
+      for (size_t i = 0; i < n; ++i) {
+        size_t len;
+        lua_rawgeti(l, 2, i + 1);
+        const char* s = lua_tolstring(l, -1, &len);
+        words[i].assign(s, len);
+        lua_pop(l, 1);
+        if (poses.empty()) continue;
+        if (posTable) {
+          lua_rawgeti(l, 3, i + 1);
+          s = lua_tolstring(l, -1, &len);
+          if (s != nullptr) poses[i].assign(s, len);
+          lua_pop(l, 1);
+        } else {
+          s = lua_tolstring(l, 3, &len);
+          poses[i].assign(s, len);
+        }
+      }
+      pool->applyBatch(words, poses, r.out, &errors, (size_t) nThreads);
+      r.errors.resize(n);
+      for (size_t i = 0; i < n; ++i) r.errors[i] = errorsAsString(errors[i]);
+      status = callProtected(l, &r, 2);
+    }
+    if (status != LUA_OK) return lua_error(l);
+    return 2;
+  }
+  // script:setLimits{replacements = n, growth = n, matchSteps = n,
+  //   luaInstructions = n}
+  static int scriptSetLimits(lua_State* l) {
+    ScriptPool* pool = checkScript(l, 1);
+    luaL_checktype(l, 2, LUA_TTABLE);
+    WordLimits limits;
+    struct { const char* name; size_t* value; } fields[] = {
+      {"replacements", &limits.replacements},
+      {"growth", &limits.growth},
+      {"matchSteps", &limits.matchSteps},
+      {"luaInstructions", &limits.luaInstructions},
+    };
+    for (const auto& f : fields) {
+      lua_getfield(l, 2, f.name);
+      if (!lua_isnil(l, -1)) {
+        lua_Integer n = luaL_checkinteger(l, -1);
+        luaL_argcheck(l, n >= 0, 2, "limits must not be negative");
+        *f.value = (size_t) n;
+      }
+      lua_pop(l, 1);
+    }
+    pool->setLimits(limits);
+    return 0;
+  }
+  static int scriptGC(lua_State* l) {
+    ScriptPool** ud =
+      (ScriptPool**) luaL_checkudata(l, 1, SCRIPT_METATABLE_NAME);
+    delete *ud;
+    *ud = nullptr;
+    return 0;
+  }
+  static const luaL_Reg scriptMethods[] = {
+    {"apply", scriptApply},
+    {"applyBatch", scriptApplyBatch},
+    {"setLimits", scriptSetLimits},
+    {"__gc", scriptGC},
+    {nullptr, nullptr}
+  };
+  static const luaL_Reg ztFunctions[] = {
+    {"load", ztLoad},
+    {"loadString", ztLoadString},
+    {nullptr, nullptr}
+  };
+}
+
+extern "C" int luaopen_zt(lua_State* l) {
+  using namespace sca::lua;
+  luaL_newmetatable(l, SCRIPT_METATABLE_NAME);
+  lua_pushvalue(l, -1);
+  lua_setfield(l, -2, "__index");
+  luaL_setfuncs(l, scriptMethods, 0);
+  lua_pop(l, 1);
+  lua_newtable(l);
+  luaL_setfuncs(l, ztFunctions, 0);
+  return 1;
+}
@@ -1,60 +1,147 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <optional>
+#include <sstream>
 #include <string>
 #include <type_traits>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
-#include "Lexer.h"
-#include "Parser.h"
 #include "Rule.h"
 #include "SCA.h"
 #include "Token.h"
+#include "diff.h"
+#include "load.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "trace.h"
 
 namespace fs = boost::filesystem;
 
+// Count heap allocations so that --profile can report them. (Lua uses its
+// own allocator, so its allocations aren't counted.)
+void* operator new(size_t n) {
+  ++sca::allocationCount;
+  void* p = malloc(n != 0 ? n : 1);
+  if (p == nullptr) abort();
+  return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
 const char* defaultFormat = "%A%?p[#]%P -> %O";
+const char* defaultDiffFormat = "%A%?p[#]%P: %O | %N";
+// The number of lines of input that make up a batch (in traces)
+const size_t batchSize = 256;
 
 const char* usage = R".(Usage:
   %s [options...] <script.zt> [words.txt]
+  %s [options...] --diff <old.zt> <new.zt> [words.txt]
 
   * <script.zt>: a path to a ztš script to apply to the words
   * <words.txt>: a path to a file of newline-separated words, or stdin
       if omitted. If a '#' is found on a line, the substring after it
       will be passed as the part of speech, while the actual word is
       truncated before the '#'.
+  * --diff: apply two versions of a script to each word, and print only the
+    words for which they give different results. The sound changes at the
+    start that are the same in both versions are only applied once.
+  * --then <script.zt>: apply another script to the output of the previous
+    one (this can be given more than once). The scripts are run in the same
+    process, and words are passed from one to the next without being
+    converted to text when possible.
   * -v, --verbose: verbose output (invocations output to stderr)
-  * -f, --format <formatter=%%A%%?p[#]%%P -> %%O>: a format string for the output:
+  * --explain-dead: list the sound changes that can never apply (because
+    they need phonemes that earlier sound changes have eliminated) and
+    why, to stderr
+  * --profile: print how much time each sound change took, how many
+    positions it was tried at and how often it matched, followed by the
+    number of heap allocations per word, to stderr. Sound changes that are
+    fused into one scan of the word are still counted separately, but the
+    time spent moving from one position to the next in such a scan isn't
+    counted towards any of them
+  * --profile-json <file>: write the same information as JSON to a file
+  * --trace <file>: write a trace of parsing, verification, Lua
+    initialisation, each batch of words, each sound change application and
+    each Γ evaluation to a file, in the Chrome Trace Event format (which
+    Perfetto can open)
+  * --max-replacements <n>, --max-growth <n>, --max-match-steps <n=100000>,
+    --max-lua-instructions <n>: limit how many replacements one sound change
+    can make in a word, how many phonemes longer than its input a word can
+    get, how many steps matching a pattern at one position can take, and
+    how many Lua instructions a Γ can run (0 means no limit). When a word
+    reaches one of these limits, it is printed as it is at that point, and
+    an error is printed to stderr.
+  * -f, --format <formatter=%%A%%?p[#]%%P -> %%O>: a format string for the output
+    (%%A%%?p[#]%%P: %%O | %%N with --diff):
     * %%%%: a literal '%%' sign
     * %%a: the input word, without the part of speech
-    * %%o: the output word
+    * %%o: the output word (of the old script, with --diff)
+    * %%n: the output of the new script (with --diff)
     * %%p: the part of speech
+    * %%{<name>}: the word at the checkpoint called <name> (declared with
+      `checkpoint <name>;` in the script; not allowed with --diff)
     * %%?*[...]: prints the string inside the square brackets if a predicate
       is true (given by whatever * is):
       * p: part of speech present
       * P: part of speech absent
   * -e, --escape <chars=\>: list characters to escape when outputting from %%a,
-    %%o or %%p in the formatter. These specifiers then precede any instances
-    of those characters. This is intended to produce output that other
-    programs can parse unambiguously; it does not handle Unicode properly.
+    %%o, %%n or %%p in the formatter. These specifiers then precede any
+    instances of those characters. This is intended to produce output that
+    other programs can parse unambiguously; it does not handle Unicode
+    properly.
   
 See README.md for documentation on the ztš language.
 ).";
 
 struct Config {
   const char* script = nullptr;
+  // The new version of the script (--diff)
+  const char* newScript = nullptr;
   const char* words = nullptr;
-  const char* format = defaultFormat;
+  const char* format = nullptr;
   const char* escapes = "\\";
   bool verbose = false;
+  bool explainDead = false;
+  bool profile = false;
+  const char* profileJSON = nullptr;
+  const char* trace = nullptr;
+  sca::WordLimits limits;
+  // Scripts to apply after the first one (--then)
+  std::vector<const char*> laterScripts;
 };
 
+// Parse a limit for one of the --max-* options.
+bool parseLimit(const char* s, size_t& out) {
+  if (s == nullptr || *s == '\0') return false;
+  char* end;
+  unsigned long long n = strtoull(s, &end, 10);
+  if (*end != '\0' || *s == '-') return false;
+  out = (size_t) n;
+  return true;
+}
+
+// Does a format string print any checkpoints?
+bool usesCheckpoints(const char* format) {
+  for (const char* w = format; *w != '\0'; ++w) {
+    if (*w != '%') continue;
+    ++w;
+    if (*w == '{') return true;
+    if (*w == '\0') break;
+  }
+  return false;
+}
+
 void parse(Config& c, int argc, char** argv) {
   char** w = argv + 1;
   unsigned pos = 0;
+  const char* positional[3];
+  bool diff = false;
   while (*w != nullptr) {
     unsigned mode = 0;
     char* arg = *(w++);
@@ -64,6 +151,16 @@ void parse(Config& c, int argc, char** argv) {
           if (strcmp(arg + 2, "format") == 0) mode = 1;
           else if (strcmp(arg + 2, "escape") == 0) mode = 2;
           else if (strcmp(arg + 2, "verbose") == 0) mode = 3;
+          else if (strcmp(arg + 2, "explain-dead") == 0) mode = 4;
+          else if (strcmp(arg + 2, "profile") == 0) mode = 5;
+          else if (strcmp(arg + 2, "profile-json") == 0) mode = 6;
+          else if (strcmp(arg + 2, "trace") == 0) mode = 7;
+          else if (strcmp(arg + 2, "max-replacements") == 0) mode = 8;
+          else if (strcmp(arg + 2, "max-growth") == 0) mode = 9;
+          else if (strcmp(arg + 2, "max-match-steps") == 0) mode = 10;
+          else if (strcmp(arg + 2, "max-lua-instructions") == 0) mode = 11;
+          else if (strcmp(arg + 2, "then") == 0) mode = 12;
+          else if (strcmp(arg + 2, "diff") == 0) mode = 13;
           else mode = -1;
           break;
         }
@@ -83,20 +180,51 @@ void parse(Config& c, int argc, char** argv) {
       else c.escapes = escapes;
     } else if (mode == 3) {
       c.verbose = true;
+    } else if (mode == 4) {
+      c.explainDead = true;
+    } else if (mode == 5) {
+      c.profile = true;
+    } else if (mode == 6) {
+      char* path = *(w++);
+      if (path == nullptr) mode = -1;
+      else c.profileJSON = path;
+    } else if (mode == 7) {
+      char* path = *(w++);
+      if (path == nullptr) mode = -1;
+      else c.trace = path;
+    } else if (mode >= 8 && mode <= 11) {
+      size_t* limits[] = {
+        &c.limits.replacements, &c.limits.growth,
+        &c.limits.matchSteps, &c.limits.luaInstructions,
+      };
+      if (!parseLimit(*(w++), *limits[mode - 8])) mode = -1;
+    } else if (mode == 12) {
+      char* path = *(w++);
+      if (path == nullptr) mode = -1;
+      else c.laterScripts.push_back(path);
+    } else if (mode == 13) {
+      diff = true;
     } else if (mode == 0) {
-      switch (pos++) {
-        case 0: c.script = arg; break;
-        case 1: c.words = arg; break;
-        default: mode = -1;
-      }
+      if (pos < 3) positional[pos++] = arg;
+      else mode = -1;
     }
     if (mode == -1) {
-      fprintf(stderr, usage, argv[0]);
+      fprintf(stderr, usage, argv[0], argv[0]);
       exit(1);
     }
   }
-  if (pos < 1) {
-    fprintf(stderr, usage, argv[0]);
+  unsigned nScripts = diff ? 2 : 1;
+  if (pos < nScripts || pos > nScripts + 1 ||
+      (diff && !c.laterScripts.empty())) {
+    fprintf(stderr, usage, argv[0], argv[0]);
+    exit(1);
+  }
+  c.script = positional[0];
+  if (diff) c.newScript = positional[1];
+  if (pos > nScripts) c.words = positional[nScripts];
+  if (c.format == nullptr) c.format = diff ? defaultDiffFormat : defaultFormat;
+  if (diff && usesCheckpoints(c.format)) {
+    std::cerr << "Checkpoints can't be printed with --diff\n";
     exit(1);
   }
 }
@@ -113,11 +241,13 @@ std::string escape(const std::string_view& s, const char* escapes) {
 std::string format(
     const char* pattern,
     const std::string_view& a, const std::string_view& o,
-    const std::string_view& p,
-    const char* escapes) {
+    const std::string_view& n, const std::string_view& p,
+    const char* escapes,
+    const sca::Pipeline& pipeline, const std::vector<std::string>& stages) {
   std::string res;
   std::string ae = escape(a, escapes);
   std::string oe = escape(o, escapes);
+  std::string ne = escape(n, escapes);
   std::string pe = escape(p, escapes);
   const char* w = pattern;
   while (*w != '\0') {
@@ -127,10 +257,28 @@ std::string format(
       case '%': res += '%'; break;
       case 'a': res += ae; break;
       case 'o': res += oe; break;
+      case 'n': res += ne; break;
       case 'p': res += pe; break;
       case 'A': res += a; break;
       case 'O': res += o; break;
+      case 'N': res += n; break;
       case 'P': res += p; break;
+      case '{': {
+        const char* end = strchr(w, '}');
+        if (end == nullptr) {
+          std::cerr << "Unclosed checkpoint name\n";
+          exit(1);
+        }
+        std::string name(w + 1, end);
+        size_t i = pipeline.getCheckpointByName(name);
+        if (i == -1) {
+          std::cerr << "Unknown checkpoint " << name << "\n";
+          exit(1);
+        }
+        res += stages[i];
+        w = end;
+        break;
+      }
       case '?': {
         char c = *(++w);
         bool predKnown = true;
@@ -168,8 +316,18 @@ std::string format(
 int main(int argc, char** argv) {
   Config c;
   parse(c, argc, argv);
-  if (!fs::exists(c.script) || fs::is_directory(c.script)) {
-    std::cerr << "File " << c.script << " doesn't exist or is a directory\n";
+  std::vector<const char*> scripts = {c.script};
+  if (c.newScript != nullptr) scripts.push_back(c.newScript);
+  scripts.insert(scripts.end(), c.laterScripts.begin(), c.laterScripts.end());
+  for (const char* script : scripts) {
+    if (!fs::exists(script) || fs::is_directory(script)) {
+      std::cerr << "File " << script << " doesn't exist or is a directory\n";
+      return 1;
+    }
+  }
+  bool profiling = c.profile || c.profileJSON != nullptr;
+  if (scripts.size() > 1 && profiling) {
+    std::cerr << "--profile and --profile-json only work with one script\n";
     return 1;
   }
   if (c.words != nullptr &&
@@ -177,41 +335,98 @@ int main(int argc, char** argv) {
     std::cerr << "File " << c.words << " doesn't exist or is a directory\n";
     return 1;
   }
-  std::fstream fh(c.script);
-  sca::Lexer lexer(&fh);
-  sca::SCA mysca;
-  sca::Parser parser(&lexer, &mysca);
-  bool res = parser.parse();
-  if (!res) return 1;
-  std::vector<sca::Error> errors;
-  mysca.verify(errors);
-  for (const sca::Error& e : errors)
-    sca::printError(e);
-  if (!errors.empty()) return 1;
-  mysca.reversePhonemeMap();
-  std::string err = mysca.executeGlobalLuaCode();
-  if (!err.empty()) {
-    std::cerr << err;
-    return 1;
+  std::ofstream traceFile;
+  std::unique_ptr<sca::TraceWriter> trace;
+  if (c.trace != nullptr) {
+    traceFile.open(c.trace);
+    trace = std::make_unique<sca::TraceWriter>(traceFile);
+    sca::activeTrace = trace.get();
+  }
+  std::vector<std::string> sources;
+  std::vector<std::unique_ptr<sca::SCA>> loaded;
+  for (const char* script : scripts) {
+    std::ifstream fh(script);
+    std::stringstream ss;
+    ss << fh.rdbuf();
+    sources.push_back(ss.str());
+    std::istringstream in(sources.back());
+    std::vector<sca::DeadRule> dead;
+    std::unique_ptr<sca::SCA> sca = sca::loadScript(in, &dead);
+    if (sca == nullptr) return 1;
+    if (c.explainDead) {
+      for (const sca::DeadRule& d : dead) {
+        const sca::Rule& r = *sca->getSoundChange(d.index).rule;
+        if (scripts.size() > 1) std::cerr << script << ": ";
+        std::cerr << "Sound change at line " << (r.line + 1) <<
+          ", column " << (r.col + 1) << " never applies: " << d.reason << "\n";
+      }
+    }
+    sca->setLimits(c.limits);
+    loaded.push_back(std::move(sca));
+  }
+  sca::Pipeline pipeline;
+  std::unique_ptr<sca::ScriptDiff> diff;
+  if (c.newScript != nullptr) {
+    diff = std::make_unique<sca::ScriptDiff>(
+      std::move(loaded[0]), sources[0], std::move(loaded[1]), sources[1]);
+    if (c.verbose) {
+      std::cerr << "Applying " << diff->getSharedCount() << " of " <<
+        diff->getOld().getSoundChangeCount() <<
+        " sound changes once for both scripts\n";
+    }
+  } else {
+    for (auto& sca : loaded) pipeline.addStage(std::move(sca));
+  }
+  std::optional<sca::Profile> profile;
+  if (profiling) {
+    profile.emplace(pipeline.getStage(0));
+    sca::activeProfile = &*profile;
   }
   std::istream* wfh = (c.words != nullptr) ?
     new std::fstream(c.words) : &(std::cin);
   std::string line;
+  // Only record the checkpoints if they're printed.
+  bool wantStages = usesCheckpoints(c.format);
+  std::vector<std::string> stages;
   while (!wfh->eof()) {
-    std::getline(*wfh, line);
-    if (line.empty()) continue;
-    size_t i = line.find("#");
-    std::string pos;
-    if (i != std::string::npos) {
-      pos = line.substr(i + 1);
-      line.resize(i);
+    sca::TraceSpan span("batch");
+    for (size_t n = 0; n < batchSize && !wfh->eof(); ++n) {
+      std::getline(*wfh, line);
+      if (line.empty()) continue;
+      size_t i = line.find("#");
+      std::string pos;
+      if (i != std::string::npos) {
+        pos = line.substr(i + 1);
+        line.resize(i);
+      }
+      std::vector<sca::Error> errors;
+      if (diff != nullptr) {
+        std::string oldOut, newOut;
+        if (diff->apply(line, pos, oldOut, newOut, c.verbose, &errors)) {
+          std::cout
+            << format(
+              c.format, line, oldOut, newOut, pos, c.escapes, pipeline,
+              stages)
+            << "\n";
+        }
+      } else {
+        std::string output = pipeline.apply(
+          line, pos, c.verbose, &errors, wantStages ? &stages : nullptr);
+        std::cout
+          << format(
+            c.format, line, output, "", pos, c.escapes, pipeline, stages)
+          << "\n";
+      }
+      for (const sca::Error& e : errors)
+        sca::printError(e);
     }
-    std::string output = mysca.apply(line, pos, c.verbose);
-    std::cout
-      << format(
-        c.format, line, output, pos, c.escapes)
-      << "\n";
   }
   if (c.words != nullptr) delete wfh;
+  sca::activeProfile = nullptr;
+  if (c.profile) sca::printProfile(std::cerr, pipeline.getStage(0), *profile);
+  if (c.profileJSON != nullptr) {
+    std::ofstream jfh(c.profileJSON);
+    sca::writeProfileJSON(jfh, pipeline.getStage(0), *profile);
+  }
   return 0;
 }
@@ -68,8 +68,14 @@ namespace sca {
         }*/
         // Get properties of fi
         // Do the classes match (or this one takes any class)?
-        if (arg.charClass != -1 && !fi.hasClass(arg.charClass))
+        // For inventory phonemes, the class and all of the constraints
+        // that don't depend on other matchers are checked in one go.
+        bool precomputed = arg.compiled && fi.id != -1;
+        if (precomputed) {
+          if (!arg.accepted.test(fi.id)) return false;
+        } else if (arg.charClass != -1 && !fi.hasClass(arg.charClass)) {
           return false;
+        }
         // Does this phoneme satisfy our constraints?
         return std::visit([&](const auto& cons) -> bool {
           using U = std::decay_t<decltype(cons)>;
@@ -77,9 +83,16 @@ namespace sca {
           size_t i = -1;
           if constexpr (std::is_same_v<U, std::vector<Constraint>>) {
             // Should match all constraints.
-            for (const CharMatcher::Constraint& con : cons) {
-              if (!con.matches(fi.getFeatureValue(con.feature, sca), mc, sca))
-                return false;
+            if (!precomputed || arg.hasDependentConstraints) {
+              for (const CharMatcher::Constraint& con : cons) {
+                if (precomputed && !con.isDependent()) continue;
+                if (!con.matches(fi.getFeatureValue(con.feature, sca), mc, sca))
+                  return false;
+              }
+            }
+            if (!precomputed) {
+              for (const CharMatcher::Group& g : arg.groups)
+                if (!g.matches(fi, sca)) return false;
             }
           } else {
             // Should be one of the phonemes enumerated.
@@ -104,11 +117,7 @@ namespace sca {
               for (size_t i = 0; i < nFeatures; ++i) {
                 size_t myval = fi.getFeatureValue(i, sca);
                 size_t remval = rememberedPS->getFeatureValue(i, sca);
-                  for (const CharMatcher::Constraint& con : cons) {
-                    if (con.feature == i) goto ignore;
-                  }
-                if (myval != remval) return false;
-                ignore:;
+                if (myval != remval && !arg.constrains(i)) return false;
               }
             } else {
               // If we have a matcher, then does the remembered index
@@ -135,7 +144,11 @@ namespace sca {
         auto it = mc.find(std::pair(arg.charClass, arg.index));
         assert(it != mc.end()); // this should have been validated before
         if (arg.hasConstraints()) {
-          auto ps = makePOwner<PhonemeSpec>(*(it->second.ps));
+          // Build the new phoneme in a reused object, since it's usually
+          // in the inventory and we won't have to keep it.
+          static thread_local PhonemeSpec scratch;
+          PhonemeSpec* ps = &scratch;
+          *ps = *(it->second.ps);
           for (const CharMatcher::Constraint& con : arg.getConstraints()) {
             assert(con.c == Comparison::eq);
             assert(con.instances.size() == 1);
@@ -144,17 +157,19 @@ namespace sca {
           auto phrange = sca.getPhonemesBySpec(*ps);
           if (phrange.first == phrange.second) {
             // Return an anonymous phoneme spec
-            return makeConst(std::move(ps));
+            ps->id = -1;
+            return makeConst(makePOwner<PhonemeSpec>(*ps));
           }
           // Find the first phoneme that matches the name, or else return the first in
           // the range
           auto it = std::find_if(phrange.first, phrange.second, [&](const auto& p) {
             return p.first.name == ps->name;
           });
-          if (it == phrange.second)
-            return makePObserver(phrange.first->first);
-          else
-            return makePObserver(it->first);
+          if (it == phrange.second) it = phrange.first;
+          // Return the phoneme itself rather than the copy in the reverse
+          // map, so that equal phonemes always have equal pointers (which
+          // findLiteral relies on).
+          return makePObserver(sca.getPhonemeByID(it->first.id));
         } else {
           size_t index = it->second.index;
           assert(index != -1);
@@ -168,6 +183,8 @@ namespace sca {
         const PhonemeSpec* ps;
         Error res = sca.getPhonemeByName(arg, ps);
         if (!res.ok()) {
+          const PhonemeSpec* stray = sca.getStrayPhoneme(arg);
+          if (stray != nullptr) return makePObserver(*stray);
           auto ps2 = makePOwner<PhonemeSpec>();
           ps2->name = std::move(arg);
           return makeConst(std::move(ps2));
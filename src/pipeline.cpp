@@ -0,0 +1,89 @@
+#include "pipeline.h"
+
+#include "trace.h"
+
+namespace sca {
+  void Pipeline::addStage(std::unique_ptr<SCA>&& sca) {
+    Stage s;
+    s.sca = std::move(sca);
+    if (!stages.empty()) {
+      const SCA& from = *stages.back().sca;
+      const SCA& to = *s.sca;
+      size_t n = from.getPhonemeCount();
+      s.fromPrevious.assign(n, nullptr);
+      s.prefixes = Bitset(n);
+      for (size_t id = 0; id < n; ++id) {
+        const std::string& name = from.getPhonemeByID(id).name;
+        const PhonemeSpec* ps;
+        if (to.getPhonemeByName(name, ps).ok()) s.fromPrevious[id] = ps;
+      }
+      // Find the names that are proper prefixes of other names.
+      Bitset prefixes(to.getPhonemeCount());
+      for (size_t id = 0; id < to.getPhonemeCount(); ++id) {
+        const std::string& name = to.getPhonemeByID(id).name;
+        for (size_t k = 1; k < name.size(); ++k) {
+          const PhonemeSpec* ps;
+          if (to.getPhonemeByName(name.substr(0, k), ps).ok())
+            prefixes.set(ps->id);
+        }
+      }
+      for (size_t id = 0; id < n; ++id) {
+        const PhonemeSpec* ps = s.fromPrevious[id];
+        if (ps != nullptr && prefixes.test(ps->id)) s.prefixes.set(id);
+      }
+    }
+    stages.push_back(std::move(s));
+  }
+  size_t Pipeline::getCheckpointByName(const std::string& name) const {
+    size_t offset = 0;
+    for (const Stage& s : stages) {
+      size_t i = s.sca->getCheckpointByName(name);
+      if (i != -1) return offset + i;
+      offset += s.sca->getCheckpointCount();
+    }
+    return -1;
+  }
+  void Pipeline::handOver(size_t i, WString& ws) const {
+    const Stage& s = stages[i];
+    const SCA& from = *stages[i - 1].sca;
+    bool direct = true;
+    for (size_t j = 0; j < ws.size() && direct; ++j) {
+      size_t id = ws[j]->id;
+      direct = id != -1 && ws[j].get() == &from.getPhonemeByID(id) &&
+        s.fromPrevious[id] != nullptr &&
+        (j + 1 == ws.size() || !s.prefixes.test(id));
+    }
+    if (!direct) {
+      ws = s.sca->tokenize(from.wStringToString(ws));
+      return;
+    }
+    // All of these are observers, so nothing is leaked by overwriting them.
+    for (auto& p : ws) p = makePObserver(*s.fromPrevious[p->id]);
+  }
+  std::string Pipeline::apply(
+      const std::string_view& st,
+      const std::string& pos,
+      bool verbose,
+      std::vector<Error>* errors,
+      std::vector<std::string>* checkpoints) const {
+    if (stages.size() == 1)
+      return stages[0].sca->apply(st, pos, verbose, errors, checkpoints);
+    TraceSpan span("word");
+    if (checkpoints != nullptr) checkpoints->clear();
+    std::vector<std::string> cps;
+    std::string res;
+    {
+      ArenaScope scratch;
+      WString ws = stages[0].sca->tokenize(st);
+      for (size_t i = 0; i < stages.size(); ++i) {
+        if (i != 0) handOver(i, ws);
+        stages[i].sca->applySoundChanges(
+          ws, pos, verbose, errors, checkpoints != nullptr ? &cps : nullptr);
+        if (checkpoints != nullptr)
+          for (std::string& c : cps) checkpoints->push_back(std::move(c));
+      }
+      res = stages.back().sca->wStringToString(ws);
+    }
+    return res;
+  }
+}
@@ -0,0 +1,92 @@
+#include "profile.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <ostream>
+
+#include "Arena.h"
+#include "SCA.h"
+
+namespace sca {
+  thread_local Profile* activeProfile = nullptr;
+  thread_local RuleProfile* currentRuleProfile = nullptr;
+  thread_local uint64_t allocationCount = 0;
+  RuleProfile& RuleProfile::operator+=(const RuleProfile& other) {
+    ns += other.ns;
+    candidates += other.candidates;
+    alphaMatches += other.alphaMatches;
+    envRejections += other.envRejections;
+    gammaEvaluations += other.gammaEvaluations;
+    gammaNs += other.gammaNs;
+    gammaCacheHits += other.gammaCacheHits;
+    replacements += other.replacements;
+    return *this;
+  }
+  Profile::Profile(const SCA& sca) : rules(sca.getSoundChangeCount()) {}
+  Profile& Profile::operator+=(const Profile& other) {
+    for (size_t i = 0; i < rules.size(); ++i) rules[i] += other.rules[i];
+    words += other.words;
+    allocations += other.allocations;
+    return *this;
+  }
+  void printProfile(std::ostream& out, const SCA& sca, const Profile& p) {
+    std::vector<size_t> order;
+    uint64_t total = 0;
+    for (size_t i = 0; i < p.rules.size(); ++i) {
+      if (p.rules[i].candidates == 0 && p.rules[i].ns == 0) continue;
+      order.push_back(i);
+      total += p.rules[i].ns;
+    }
+    std::stable_sort(order.begin(), order.end(), [&p](size_t a, size_t b) {
+      return p.rules[a].ns > p.rules[b].ns;
+    });
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%-10s %10s %6s %11s %12s %11s %10s %11s %10s %11s\n",
+      "rule", "time/ms", "%", "candidates", "α matches", "env rejects",
+      "Γ evals", "Γ time/ms", "Γ cached", "replaced");
+    out << buf;
+    for (size_t i : order) {
+      const RuleProfile& r = p.rules[i];
+      const Rule& rule = *sca.getSoundChange(i).rule;
+      std::string where =
+        std::to_string(rule.line + 1) + ":" + std::to_string(rule.col + 1);
+      snprintf(buf, sizeof(buf),
+        "%-10s %10.3f %6.2f %11llu %11llu %11llu %9llu %10.3f %9llu %11llu\n",
+        where.c_str(), r.ns / 1e6, (total != 0) ? 100.0 * r.ns / total : 0.0,
+        (unsigned long long) r.candidates,
+        (unsigned long long) r.alphaMatches,
+        (unsigned long long) r.envRejections,
+        (unsigned long long) r.gammaEvaluations, r.gammaNs / 1e6,
+        (unsigned long long) r.gammaCacheHits,
+        (unsigned long long) r.replacements);
+      out << buf;
+    }
+    snprintf(buf, sizeof(buf),
+      "%llu words, %.2f heap allocations per word, %zu bytes of scratch "
+      "arena\n",
+      (unsigned long long) p.words,
+      (p.words != 0) ? (double) p.allocations / p.words : 0.0,
+      getThreadArena().capacity());
+    out << buf;
+  }
+  void writeProfileJSON(std::ostream& out, const SCA& sca, const Profile& p) {
+    out << "[\n";
+    for (size_t i = 0; i < p.rules.size(); ++i) {
+      const RuleProfile& r = p.rules[i];
+      const Rule& rule = *sca.getSoundChange(i).rule;
+      out << "  {\"line\": " << (rule.line + 1) <<
+        ", \"col\": " << (rule.col + 1) <<
+        ", \"ns\": " << r.ns <<
+        ", \"candidates\": " << r.candidates <<
+        ", \"alphaMatches\": " << r.alphaMatches <<
+        ", \"envRejections\": " << r.envRejections <<
+        ", \"gammaEvaluations\": " << r.gammaEvaluations <<
+        ", \"gammaNs\": " << r.gammaNs <<
+        ", \"gammaCacheHits\": " << r.gammaCacheHits <<
+        ", \"replacements\": " << r.replacements << "}";
+      out << ((i + 1 < p.rules.size()) ? ",\n" : "\n");
+    }
+    out << "]\n";
+  }
+}
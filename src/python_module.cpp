@@ -0,0 +1,280 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "SCA.h"
+#include "batch.h"
+
+/*
+  The `zt` extension module, for using ztš from Python:
+
+    import zt
+    script = zt.Script.load("7_1_1.zt")
+    script.apply("word", "n")
+    script.apply_many([("word", "n"), "other"], threads=4)
+*/
+
+namespace {
+  struct ScriptObject {
+    PyObject_HEAD
+    sca::ScriptPool* pool;
+  };
+  PyObject* ztError = nullptr;
+  PyObject* scriptType = nullptr;
+  PyObject* newScript(std::unique_ptr<sca::ScriptPool> pool) {
+    PyTypeObject* type = (PyTypeObject*) scriptType;
+    ScriptObject* self = (ScriptObject*) type->tp_alloc(type, 0);
+    if (self == nullptr) return nullptr;
+    self->pool = pool.release();
+    return (PyObject*) self;
+  }
+  void scriptDealloc(PyObject* o) {
+    ScriptObject* self = (ScriptObject*) o;
+    delete self->pool;
+    PyTypeObject* type = Py_TYPE(o);
+    type->tp_free(o);
+    Py_DECREF(type);
+  }
+  // Script.load(path)
+  PyObject* scriptLoad(PyObject*, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path)) return nullptr;
+    std::ifstream fh(path);
+    if (!fh) {
+      PyErr_Format(PyExc_OSError, "could not open %s", path);
+      return nullptr;
+    }
+    std::stringstream ss;
+    ss << fh.rdbuf();
+    auto pool = sca::ScriptPool::load(ss.str());
+    if (pool == nullptr) {
+      PyErr_Format(ztError, "could not load %s (see stderr)", path);
+      return nullptr;
+    }
+    return newScript(std::move(pool));
+  }
+  // Script.from_string(source)
+  PyObject* scriptFromString(PyObject*, PyObject* args) {
+    const char* source;
+    Py_ssize_t len;
+    if (!PyArg_ParseTuple(args, "s#", &source, &len)) return nullptr;
+    auto pool = sca::ScriptPool::load(std::string(source, len));
+    if (pool == nullptr) {
+      PyErr_SetString(ztError, "could not load script (see stderr)");
+      return nullptr;
+    }
+    return newScript(std::move(pool));
+  }
+  PyObject* errorList(const std::vector<sca::Error>& errors) {
+    PyObject* list = PyList_New(errors.size());
+    if (list == nullptr) return nullptr;
+    for (size_t i = 0; i < errors.size(); ++i) {
+      std::string s = sca::errorAsString(errors[i]);
+      s.pop_back(); // the newline
+      PyObject* str = PyUnicode_FromStringAndSize(s.data(), s.size());
+      if (str == nullptr) {
+        Py_DECREF(list);
+        return nullptr;
+      }
+      PyList_SET_ITEM(list, i, str);
+    }
+    return list;
+  }
+  // script.apply(word, pos="", return_errors=False)
+  PyObject* scriptApply(PyObject* o, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"word", "pos", "return_errors", nullptr};
+    ScriptObject* self = (ScriptObject*) o;
+    const char* word;
+    Py_ssize_t len;
+    const char* pos = "";
+    int returnErrors = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|sp", (char**) keywords,
+        &word, &len, &pos, &returnErrors))
+      return nullptr;
+    std::vector<sca::Error> errors;
+    std::string out;
+    // This might wait for apply_many to finish with the script on another
+    // thread, so let other Python threads run in the meantime. `word` and
+    // `pos` belong to the arguments, which are kept alive by the caller.
+    Py_BEGIN_ALLOW_THREADS
+    out = self->pool->apply(std::string_view(word, len), pos, &errors);
+    Py_END_ALLOW_THREADS
+    PyObject* res = PyUnicode_FromStringAndSize(out.data(), out.size());
+    if (res == nullptr || !returnErrors) return res;
+    PyObject* errs = errorList(errors);
+    if (errs == nullptr) {
+      Py_DECREF(res);
+      return nullptr;
+    }
+    return Py_BuildValue("(NN)", res, errs);
+  }
+  // Read one item for apply_many: a word, or a (word, pos) pair.
+  bool readItem(PyObject* item, std::string& word, std::string& pos) {
+    PyObject* w = item;
+    PyObject* p = nullptr;
+    if (!PyUnicode_Check(item)) {
+      if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2) {
+        PyErr_SetString(PyExc_TypeError,
+          "expected a word or a (word, pos) tuple");
+        return false;
+      }
+      w = PyTuple_GET_ITEM(item, 0);
+      p = PyTuple_GET_ITEM(item, 1);
+    }
+    Py_ssize_t len;
+    const char* s = PyUnicode_AsUTF8AndSize(w, &len);
+    if (s == nullptr) return false;
+    word.assign(s, len);
+    pos.clear();
+    if (p != nullptr && p != Py_None) {
+      s = PyUnicode_AsUTF8AndSize(p, &len);
+      if (s == nullptr) return false;
+      pos.assign(s, len);
+    }
+    return true;
+  }
+  // script.apply_many(items, threads=0, return_errors=False)
+  PyObject* scriptApplyMany(PyObject* o, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] =
+      {"items", "threads", "return_errors", nullptr};
+    ScriptObject* self = (ScriptObject*) o;
+    PyObject* items;
+    Py_ssize_t nThreads = 0;
+    int returnErrors = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|np", (char**) keywords,
+        &items, &nThreads, &returnErrors))
+      return nullptr;
+    if (nThreads < 0) {
+      PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+      return nullptr;
+    }
+    PyObject* it = PyObject_GetIter(items);
+    if (it == nullptr) return nullptr;
+    std::vector<std::string> words, poses, out;
+    bool anyPOS = false;
+    while (PyObject* item = PyIter_Next(it)) {
+      words.emplace_back();
+      poses.emplace_back();
+      bool ok = readItem(item, words.back(), poses.back());
+      Py_DECREF(item);
+      if (!ok) {
+        Py_DECREF(it);
+        return nullptr;
+      }
+      anyPOS = anyPOS || !poses.back().empty();
+    }
+    Py_DECREF(it);
+    if (PyErr_Occurred()) return nullptr;
+    if (!anyPOS) poses.clear();
+    std::vector<std::vector<sca::Error>> errors;
+    Py_BEGIN_ALLOW_THREADS
+    self->pool->applyBatch(words, poses, out, &errors, nThreads);
+    Py_END_ALLOW_THREADS
+    PyObject* res = PyList_New(out.size());
+    if (res == nullptr) return nullptr;
+    for (size_t i = 0; i < out.size(); ++i) {
+      PyObject* s = PyUnicode_FromStringAndSize(out[i].data(), out[i].size());
+      if (s == nullptr) {
+        Py_DECREF(res);
+        return nullptr;
+      }
+      PyList_SET_ITEM(res, i, s);
+    }
+    if (!returnErrors) return res;
+    PyObject* errs = PyList_New(errors.size());
+    if (errs == nullptr) {
+      Py_DECREF(res);
+      return nullptr;
+    }
+    for (size_t i = 0; i < errors.size(); ++i) {
+      PyObject* l = errorList(errors[i]);
+      if (l == nullptr) {
+        Py_DECREF(res);
+        Py_DECREF(errs);
+        return nullptr;
+      }
+      PyList_SET_ITEM(errs, i, l);
+    }
+    return Py_BuildValue("(NN)", res, errs);
+  }
+  // script.set_limits(replacements=0, growth=0, match_steps=100000,
+  //   lua_instructions=0)
+  PyObject* scriptSetLimits(PyObject* o, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {
+      "replacements", "growth", "match_steps", "lua_instructions", nullptr};
+    ScriptObject* self = (ScriptObject*) o;
+    sca::WordLimits limits;
+    Py_ssize_t values[] = {
+      (Py_ssize_t) limits.replacements, (Py_ssize_t) limits.growth,
+      (Py_ssize_t) limits.matchSteps, (Py_ssize_t) limits.luaInstructions,
+    };
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$nnnn",
+        (char**) keywords, &values[0], &values[1], &values[2], &values[3]))
+      return nullptr;
+    for (Py_ssize_t v : values) {
+      if (v < 0) {
+        PyErr_SetString(PyExc_ValueError, "limits must not be negative");
+        return nullptr;
+      }
+    }
+    limits.replacements = values[0];
+    limits.growth = values[1];
+    limits.matchSteps = values[2];
+    limits.luaInstructions = values[3];
+    self->pool->setLimits(limits);
+    Py_RETURN_NONE;
+  }
+  PyMethodDef scriptMethods[] = {
+    {"load", scriptLoad, METH_VARARGS | METH_STATIC,
+      "Load a script from a file."},
+    {"from_string", scriptFromString, METH_VARARGS | METH_STATIC,
+      "Load a script from a string."},
+    {"apply", (PyCFunction) (void (*)(void)) scriptApply,
+      METH_VARARGS | METH_KEYWORDS,
+      "Apply the sound changes to a word."},
+    {"apply_many", (PyCFunction) (void (*)(void)) scriptApplyMany,
+      METH_VARARGS | METH_KEYWORDS,
+      "Apply the sound changes to each word (or (word, pos) tuple) in an "
+      "iterable, on several threads, and return a list of the results."},
+    {"set_limits", (PyCFunction) (void (*)(void)) scriptSetLimits,
+      METH_VARARGS | METH_KEYWORDS,
+      "Set limits on the work done on each word (see --max-*)."},
+    {nullptr, nullptr, 0, nullptr}
+  };
+  PyType_Slot scriptSlots[] = {
+    {Py_tp_dealloc, (void*) scriptDealloc},
+    {Py_tp_methods, scriptMethods},
+    {Py_tp_doc, (void*) "A ztš script. Use Script.load to create one."},
+    {0, nullptr}
+  };
+  PyType_Spec scriptSpec = {
+    "zt.Script", sizeof(ScriptObject), 0, Py_TPFLAGS_DEFAULT, scriptSlots,
+  };
+  PyModuleDef ztModule = {
+    PyModuleDef_HEAD_INIT, "zt", "Apply ztš scripts to words.", -1,
+    nullptr, nullptr, nullptr, nullptr, nullptr,
+  };
+}
+
+PyMODINIT_FUNC PyInit_zt() {
+  PyObject* m = PyModule_Create(&ztModule);
+  if (m == nullptr) return nullptr;
+  scriptType = PyType_FromSpec(&scriptSpec);
+  ztError = PyErr_NewException("zt.Error", nullptr, nullptr);
+  if (scriptType == nullptr || ztError == nullptr) {
+    Py_DECREF(m);
+    return nullptr;
+  }
+  Py_INCREF(scriptType);
+  Py_INCREF(ztError);
+  if (PyModule_AddObject(m, "Script", scriptType) < 0 ||
+      PyModule_AddObject(m, "Error", ztError) < 0) {
+    Py_DECREF(m);
+    return nullptr;
+  }
+  return m;
+}
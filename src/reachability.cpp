@@ -0,0 +1,467 @@
+#include "SCA.h"
+
+#include <algorithm>
+#include <optional>
+
+#include "Bitset.h"
+#include "Rule.h"
+#include "matching.h"
+
+/*
+  Static reachability analysis over the list of sound changes.
+
+  We start by assuming that any phoneme in the inventory can occur in a
+  word, and then go through the sound changes in order, tracking which
+  phonemes could still occur before each one. A sound change whose α (or
+  every one of whose environments) needs a phoneme that can't occur at
+  that point will never apply, so we drop it from the rule lists.
+
+  Phonemes that are not in the inventory can always occur, since they can
+  come straight from the input.
+
+  We also use this to find runs of adjacent sound changes that can't
+  affect each other, so that they can run in a single scan of the word
+  (see SCA::fuseRules).
+*/
+
+namespace sca {
+  struct ReachabilityContext {
+    const SCA& sca;
+    // Inventory phonemes that might occur in a word at this point
+    Bitset phonemes;
+    // Classes of anonymous phonemes (created by changing the features of
+    // a phoneme in ω) that might occur at this point
+    Bitset anonClasses;
+    // For each phoneme, the sound change that last eliminated it, or -1
+    std::vector<size_t> eliminatedBy;
+  };
+  static bool isDependent(const CharMatcher::Constraint& con) {
+    return con.isDependent();
+  }
+  // Could `m` match the inventory phoneme `ps`? If `always` is true, then
+  // return true only if `m` matches `ps` no matter what other matchers
+  // have captured.
+  static bool matcherAccepts(
+      const SCA& sca, const CharMatcher& m, const PhonemeSpec& ps,
+      bool always) {
+    if (!m.hasConstraints()) {
+      if (m.charClass != -1 && !ps.hasClass(m.charClass)) return false;
+      const auto& e = m.getEnumeration();
+      return std::any_of(e.begin(), e.end(), [&ps](const PhonemeSpec* p) {
+        return p->id == ps.id;
+      });
+    }
+    if (always && m.hasDependentConstraints) return false;
+    return m.compiled ?
+      m.accepted.test(ps.id) : m.acceptsStatically(ps, sca);
+  }
+  static std::string describeMatcher(const SCA& sca, const CharMatcher& m) {
+    std::string s = "$(" + m.toString(sca);
+    if (m.hasConstraints()) {
+      const auto& cons = m.getConstraints();
+      for (size_t i = 0; i < cons.size(); ++i) {
+        s += (i == 0) ? '|' : ',';
+        s += cons[i].toString(sca);
+      }
+      for (size_t i = 0; i < m.groups.size(); ++i) {
+        s += (i == 0 && cons.empty()) ? '|' : ',';
+        s += m.groups[i].toString(sca);
+      }
+    } else {
+      const auto& e = m.getEnumeration();
+      for (size_t i = 0; i < e.size(); ++i) {
+        s += (i == 0) ? '/' : ',';
+        s += e[i]->name;
+      }
+    }
+    return s + ")";
+  }
+  static std::string describeEliminated(
+      const ReachabilityContext& ctx, const PhonemeSpec& ps) {
+    size_t by = ctx.eliminatedBy[ps.id];
+    if (by == -1) return ps.name;
+    const Rule& r = *ctx.sca.getSoundChange(by).rule;
+    return ps.name + " (eliminated by the sound change at line " +
+      std::to_string(r.line + 1) + ", column " + std::to_string(r.col + 1) +
+      ")";
+  }
+  static std::optional<std::string> findImpossible(
+    const ReachabilityContext& ctx, const MString& s);
+  // Return a description of why `ch` can't match anything that might occur,
+  // or std::nullopt if it might match something.
+  static std::optional<std::string> findImpossible(
+      const ReachabilityContext& ctx, const MChar& ch) {
+    return std::visit([&](const auto& arg) -> std::optional<std::string> {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (std::is_same_v<T, std::string>) {
+        const PhonemeSpec* ps;
+        Error res = ctx.sca.getPhonemeByName(arg, ps);
+        if (!res.ok() || ctx.phonemes.test(ps->id)) return std::nullopt;
+        return describeEliminated(ctx, *ps);
+      } else if constexpr (std::is_same_v<T, CharMatcher>) {
+        if (arg.hasConstraints() &&
+            (arg.charClass == -1 || ctx.anonClasses.test(arg.charClass)))
+          return std::nullopt;
+        bool any = false;
+        ctx.phonemes.forEach([&](size_t id) {
+          if (!any)
+            any = matcherAccepts(
+              ctx.sca, arg, ctx.sca.getPhonemeByID(id), false);
+        });
+        if (any) return std::nullopt;
+        return describeMatcher(ctx.sca, arg);
+      } else if constexpr (std::is_same_v<T, Alternation>) {
+        std::string reasons;
+        for (const MString& opt : arg.options) {
+          auto why = findImpossible(ctx, opt);
+          if (!why.has_value()) return std::nullopt;
+          if (!reasons.empty()) reasons += " or ";
+          reasons += *why;
+        }
+        return reasons;
+      } else if constexpr (std::is_same_v<T, Repeat>) {
+        if (arg.min == 0) return std::nullopt;
+        return findImpossible(ctx, arg.s);
+      } else {
+        return std::nullopt;
+      }
+    }, ch.value);
+  }
+  static std::optional<std::string> findImpossible(
+      const ReachabilityContext& ctx, const MString& s) {
+    for (const MChar& ch : s) {
+      auto why = findImpossible(ctx, ch);
+      if (why.has_value()) return why;
+    }
+    return std::nullopt;
+  }
+  static std::optional<std::string> whyDead(
+      const ReachabilityContext& ctx, const SimpleRule& r) {
+    auto why = findImpossible(ctx, r.alpha);
+    if (why.has_value()) return "α needs " + *why;
+    if (r.inv || r.envs.empty()) return std::nullopt;
+    std::string reasons;
+    for (const auto& p : r.envs) {
+      why = findImpossible(ctx, p.first);
+      if (!why.has_value()) why = findImpossible(ctx, p.second);
+      if (!why.has_value()) return std::nullopt;
+      if (!reasons.empty()) reasons += "; ";
+      reasons += *why;
+    }
+    return "no environment can match: needs " + reasons;
+  }
+  // Add every phoneme whose primary class is `cc` that satisfies the fixed
+  // constraints of `m` to `out`.
+  static void addAllWithFeatures(
+      const ReachabilityContext& ctx, const CharMatcher& m, size_t cc,
+      Bitset& out) {
+    size_t n = ctx.sca.getPhonemeCount();
+    for (size_t id = 0; id < n; ++id) {
+      const PhonemeSpec& ps = ctx.sca.getPhonemeByID(id);
+      if (ps.charClass != cc) continue;
+      bool ok = true;
+      for (const CharMatcher::Constraint& con : m.getConstraints()) {
+        if (isDependent(con)) continue;
+        if (ps.getFeatureValue(con.feature, ctx.sca) !=
+            std::get<size_t>(con.instances[0])) {
+          ok = false;
+          break;
+        }
+      }
+      if (ok) out.set(id);
+    }
+  }
+  // Add the phonemes that might be output by `r` to `out`, and the classes
+  // of any anonymous phonemes to `outAnon`.
+  static void addOutputs(
+      const ReachabilityContext& ctx, const SimpleRule& r,
+      Bitset& out, Bitset& outAnon) {
+    const SCA& sca = ctx.sca;
+    for (const MChar& ch : r.omega) {
+      if (ch.is<std::string>()) {
+        const PhonemeSpec* ps;
+        if (sca.getPhonemeByName(ch.as<std::string>(), ps).ok())
+          out.set(ps->id);
+        continue;
+      }
+      if (!ch.is<CharMatcher>()) continue;
+      const CharMatcher& m = ch.as<CharMatcher>();
+      if (!m.hasConstraints()) {
+        for (const PhonemeSpec* ps : m.getEnumeration()) out.set(ps->id);
+        continue;
+      }
+      const auto& cons = m.getConstraints();
+      bool dependent = std::any_of(cons.begin(), cons.end(), isDependent);
+      // The phoneme that this matcher captured could be any phoneme of its
+      // class that might occur. Do what applyOmega does to each of them.
+      ctx.phonemes.forEach([&](size_t id) {
+        const PhonemeSpec& source = sca.getPhonemeByID(id);
+        if (m.charClass != -1 && !source.hasClass(m.charClass)) return;
+        if (dependent) {
+          // Phonemes are looked up by their primary class, but an
+          // anonymous result keeps all of the source's classes.
+          addAllWithFeatures(ctx, m, source.charClass, out);
+          source.classes.forEach([&](size_t cc) { outAnon.set(cc); });
+          return;
+        }
+        PhonemeSpec spec = source;
+        for (const CharMatcher::Constraint& con : cons)
+          spec.setFeatureValue(
+            con.feature, std::get<size_t>(con.instances[0]), sca);
+        auto phrange = sca.getPhonemesBySpec(spec);
+        if (phrange.first == phrange.second) {
+          spec.classes.forEach([&](size_t cc) { outAnon.set(cc); });
+          return;
+        }
+        auto it = std::find_if(phrange.first, phrange.second,
+          [&](const auto& p) { return p.first.name == spec.name; });
+        if (it == phrange.second) it = phrange.first;
+        out.set(it->first.id);
+      });
+      // It could also have captured a phoneme not in the inventory.
+      if (m.charClass == -1) {
+        addAllWithFeatures(ctx, m, -1, out);
+        ctx.anonClasses.forEach([&](size_t cc) {
+          addAllWithFeatures(ctx, m, cc, out);
+        });
+      } else if (ctx.anonClasses.test(m.charClass)) {
+        addAllWithFeatures(ctx, m, m.charClass, out);
+        outAnon.set(m.charClass);
+      }
+    }
+  }
+  // Return the phonemes that can't survive `sc`: those that α always matches
+  // when α is a single character with no environment, Γ or native
+  // condition, and `sc` keeps applying until it runs out of matches.
+  static Bitset getEliminated(
+      const ReachabilityContext& ctx, const SoundChange& sc,
+      const SimpleRule& r) {
+    Bitset killed(ctx.sca.getPhonemeCount());
+    if (sc.opt.beh == Behaviour::once || !sc.poses.empty()) return killed;
+    if (r.gammaref != LUA_NOREF || !r.conditions.empty() || r.inv ||
+        !r.envs.empty())
+      return killed;
+    // Deleting a character with a looping rule skips over the next one.
+    if (r.alpha.size() != 1 || r.omega.empty()) return killed;
+    const MChar& ch = r.alpha[0];
+    if (ch.is<std::string>()) {
+      const PhonemeSpec* ps;
+      if (ctx.sca.getPhonemeByName(ch.as<std::string>(), ps).ok())
+        killed.set(ps->id);
+    } else if (ch.is<CharMatcher>()) {
+      ctx.phonemes.forEach([&](size_t id) {
+        const PhonemeSpec& ps = ctx.sca.getPhonemeByID(id);
+        if (matcherAccepts(ctx.sca, ch.as<CharMatcher>(), ps, true))
+          killed.set(id);
+      });
+    }
+    return killed;
+  }
+  void SCA::eliminateDeadRules(std::vector<DeadRule>& dead) {
+    size_t nPhonemes = phonemesByID.size();
+    ReachabilityContext ctx = {
+      *this,
+      Bitset(nPhonemes, true),
+      Bitset(charClasses.size()),
+      std::vector<size_t>(nPhonemes, -1),
+    };
+    reachable.clear();
+    std::vector<bool> isDead(rules.size());
+    for (size_t ri = 0; ri < rules.size(); ++ri) {
+      reachable.push_back(ctx.phonemes);
+      const SoundChange& sc = rules[ri];
+      auto [srs, n] = sc.rule->getSimpleRules();
+      // The components of a compound rule can feed each other during the
+      // same scan, so iterate until nothing new comes alive.
+      std::vector<bool> alive(n);
+      Bitset out(nPhonemes), outAnon(charClasses.size());
+      ReachabilityContext local = ctx;
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        for (size_t i = 0; i < n; ++i) {
+          if (alive[i] || whyDead(local, srs[i]).has_value()) continue;
+          alive[i] = changed = true;
+          addOutputs(local, srs[i], out, outAnon);
+        }
+        if (n == 1) break;
+        local.phonemes |= out;
+        local.anonClasses |= outAnon;
+      }
+      if (std::none_of(alive.begin(), alive.end(), [](bool b) { return b; })) {
+        std::string reasons;
+        for (size_t i = 0; i < n; ++i) {
+          if (!reasons.empty()) reasons += "; ";
+          reasons += *whyDead(ctx, srs[i]);
+        }
+        dead.push_back({ri, std::move(reasons)});
+        isDead[ri] = true;
+        continue;
+      }
+      if (n == 1) {
+        Bitset killed = getEliminated(ctx, sc, srs[0]);
+        killed.subtract(out);
+        killed.forEach([&](size_t id) { ctx.eliminatedBy[id] = ri; });
+        ctx.phonemes.subtract(killed);
+      }
+      ctx.phonemes |= out;
+      ctx.anonClasses |= outAnon;
+    }
+    reachable.push_back(ctx.phonemes);
+    auto dropDead = [&isDead](std::vector<size_t>& l) {
+      l.erase(std::remove_if(l.begin(), l.end(), [&isDead](size_t ri) {
+        return isDead[ri];
+      }), l.end());
+    };
+    dropDead(unrestrictedRules);
+    for (std::vector<size_t>& l : rulesByPOS) dropDead(l);
+  }
+  // ------------------------------------------------------------------
+  // The phonemes that a sound change looks at, and those that it might
+  // remove or introduce. Phonemes outside the inventory get a flag each.
+  struct Footprint {
+    Bitset reads, writes;
+    bool readsOther = false, writesOther = false;
+    EvaluationOrder eo;
+    bool conflictsWith(const Footprint& other, const Bitset& mask) const {
+      if (readsOther && other.writesOther) return true;
+      Bitset r = reads;
+      r &= mask;
+      return r.intersects(other.writes);
+    }
+  };
+  // Add every phoneme that `ch` might match to `fp.reads`. Returns false if
+  // we can't tell.
+  static bool addReads(const SCA& sca, const MChar& ch, Footprint& fp) {
+    return std::visit([&](const auto& arg) -> bool {
+      using T = std::decay_t<decltype(arg)>;
+      if constexpr (std::is_same_v<T, std::string>) {
+        const PhonemeSpec* ps;
+        if (sca.getPhonemeByName(arg, ps).ok()) fp.reads.set(ps->id);
+        else fp.readsOther = true;
+        return true;
+      } else if constexpr (std::is_same_v<T, CharMatcher>) {
+        for (size_t id = 0; id < sca.getPhonemeCount(); ++id) {
+          if (matcherAccepts(sca, arg, sca.getPhonemeByID(id), false))
+            fp.reads.set(id);
+        }
+        // Only a matcher with constraints can accept an anonymous phoneme.
+        if (arg.hasConstraints()) fp.readsOther = true;
+        return true;
+      } else if constexpr (std::is_same_v<T, Space>) {
+        return true;
+      } else if constexpr (std::is_same_v<T, Alternation>) {
+        for (const MString& opt : arg.options) {
+          for (const MChar& c : opt)
+            if (!addReads(sca, c, fp)) return false;
+        }
+        return true;
+      } else if constexpr (std::is_same_v<T, Repeat>) {
+        for (const MChar& c : arg.s)
+          if (!addReads(sca, c, fp)) return false;
+        return true;
+      } else {
+        return false;
+      }
+    }, ch.value);
+  }
+  // Work out the footprint of `sc`, or return std::nullopt if it can't be
+  // fused with anything. We only fuse simple rules without Γ that replace
+  // each character of α with one character, so that the positions of the
+  // other rules in the same pass don't shift.
+  static std::optional<Footprint> getFootprint(
+      const SCA& sca, const SoundChange& sc) {
+    auto [srs, n] = sc.rule->getSimpleRules();
+    if (n != 1) return std::nullopt;
+    const SimpleRule& r = *srs;
+    if (r.gammaref != LUA_NOREF) return std::nullopt;
+    // Counting phonemes and syllables looks at the whole word, which other
+    // rules in the pass might be changing.
+    for (const NativeCondition& nc : r.conditions)
+      if (nc.q == NativeCondition::Quantity::classCount || nc.isSyllabic())
+        return std::nullopt;
+    if (r.alpha.empty() || r.alpha.size() != r.omega.size())
+      return std::nullopt;
+    auto isPlain = [](const MChar& ch) {
+      return ch.is<std::string>() || ch.is<CharMatcher>();
+    };
+    if (!std::all_of(r.alpha.begin(), r.alpha.end(), isPlain) ||
+        !std::all_of(r.omega.begin(), r.omega.end(), isPlain))
+      return std::nullopt;
+    size_t nPhonemes = sca.getPhonemeCount();
+    Footprint fp = {Bitset(nPhonemes), Bitset(nPhonemes)};
+    fp.eo = sc.opt.eo;
+    // Whatever α matches might be replaced.
+    for (const MChar& ch : r.alpha) addReads(sca, ch, fp);
+    fp.writes = fp.reads;
+    fp.writesOther = fp.readsOther;
+    for (const auto& p : r.envs) {
+      for (const MChar& ch : p.first)
+        if (!addReads(sca, ch, fp)) return std::nullopt;
+      for (const MChar& ch : p.second)
+        if (!addReads(sca, ch, fp)) return std::nullopt;
+    }
+    ReachabilityContext ctx = {
+      sca,
+      Bitset(nPhonemes, true),
+      Bitset(sca.getClassCount(), true),
+      {},
+    };
+    Bitset outAnon(sca.getClassCount());
+    addOutputs(ctx, r, fp.writes, outAnon);
+    for (const MChar& ch : r.omega) {
+      const PhonemeSpec* ps;
+      if (ch.is<CharMatcher>() ? ch.as<CharMatcher>().hasConstraints() :
+          !sca.getPhonemeByName(ch.as<std::string>(), ps).ok())
+        fp.writesOther = true;
+    }
+    return fp;
+  }
+  // Split `l` into passes, returning the end index of each.
+  static std::vector<size_t> fuseList(
+      const SCA& sca, const std::vector<size_t>& l,
+      const std::vector<std::optional<Footprint>>& footprints) {
+    std::vector<size_t> ends;
+    size_t begin = 0;
+    // The phonemes that might occur during the current pass
+    Bitset mask;
+    for (size_t i = 0; i < l.size(); ++i) {
+      const auto& fp = footprints[l[i]];
+      // Passes don't go past checkpoints, which need the word as it is
+      // between two sound changes.
+      bool fuse = i > begin && i - begin < MAX_FUSED && fp.has_value() &&
+        !sca.hasCheckpointBetween(l[i - 1], l[i]);
+      if (fuse) {
+        const auto& first = footprints[l[begin]];
+        fuse = first.has_value() && first->eo == fp->eo;
+      }
+      if (fuse) {
+        Bitset m = mask;
+        m |= fp->writes;
+        for (size_t j = begin; j < i && fuse; ++j) {
+          const Footprint& other = *footprints[l[j]];
+          fuse = !fp->conflictsWith(other, m) && !other.conflictsWith(*fp, m);
+        }
+      }
+      if (fuse) {
+        mask |= fp->writes;
+        continue;
+      }
+      if (i > begin) ends.push_back(i);
+      begin = i;
+      mask = sca.getReachable(l[i]);
+      if (fp.has_value()) mask |= fp->writes;
+    }
+    if (!l.empty()) ends.push_back(l.size());
+    return ends;
+  }
+  void SCA::fuseRules() {
+    std::vector<std::optional<Footprint>> footprints;
+    for (const SoundChange& sc : rules)
+      footprints.push_back(getFootprint(*this, sc));
+    unrestrictedPasses = fuseList(*this, unrestrictedRules, footprints);
+    passesByPOS.clear();
+    for (const std::vector<size_t>& l : rulesByPOS)
+      passesByPOS.push_back(fuseList(*this, l, footprints));
+  }
+}
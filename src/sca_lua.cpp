@@ -93,6 +93,12 @@ namespace sca::lua {
     pushCharClass(l, *cc);
     return 1;
   }
+  // n = sca:getFeatureCount()
+  int scaGetFeatureCount(lua_State* l) {
+    SCA* sca = checkForSCA(l, 1);
+    lua_pushinteger(l, sca->getFeatureCount());
+    return 1;
+  }
   // ======================== PhonemeSpec ===========================
   // name = ps:getName()
   int psGetName(lua_State* l) {
@@ -118,6 +124,13 @@ namespace sca::lua {
     lua_pushinteger(l, ps->charClass);
     return 1;
   }
+  // isMember = ps:hasCharClass(charClassIndex)
+  int psHasCharClass(lua_State* l) {
+    PhonemeSpec* ps = checkForPhonemeSpec(l, 1);
+    lua_Integer cc = luaL_checkinteger(l, 2);
+    lua_pushboolean(l, cc >= 0 && ps->hasClass((size_t) cc));
+    return 1;
+  }
   // fv = ps:getFeatureValue(fid, sca)
   int psGetFeatureValue(lua_State* l) {
     PhonemeSpec* ps = checkForPhonemeSpec(l, 1);
@@ -147,6 +160,20 @@ namespace sca::lua {
     lua_pushlstring(l, name.c_str(), name.size());
     return 1;
   }
+  // p = ps:getFeatureValues(sca)
+  // A light userdata pointing to the values of all of the features of
+  // this phoneme, as an array of size_t indexed by feature ID. This is
+  // meant for LuaJIT's FFI:
+  //   local fv = ffi.cast("const size_t*", ps:getFeatureValues(sca))
+  // The pointer is valid for as long as the phoneme is.
+  int psGetFeatureValues(lua_State* l) {
+    PhonemeSpec* ps = checkForPhonemeSpec(l, 1);
+    SCA* sca = checkForSCA(l, 2);
+    // A no-op for inventory phonemes, which are filled in already.
+    ps->fillFeatureValues(*sca);
+    lua_pushlightuserdata(l, ps->featureValues.data());
+    return 1;
+  }
   // ======================== Feature ===============================
   // name = feature:getName()
   int featureGetName(lua_State* l) {
@@ -197,14 +224,17 @@ namespace sca::lua {
     {"getClass", scaGetClass},
     {"getFeatureByIndex", scaGetFeatureByIndex},
     {"getClassByIndex", scaGetClassByIndex},
+    {"getFeatureCount", scaGetFeatureCount},
     {nullptr, nullptr}
   };
   static const luaL_Reg psMethods[] = {
     {"getName", psGetName},
     {"getCharClass", psGetCharClass},
     {"getCharClassIndex", psGetCharClassIndex},
+    {"hasCharClass", psHasCharClass},
     {"getFeatureValue", psGetFeatureValue},
     {"getFeatureName", psGetFeatureName},
+    {"getFeatureValues", psGetFeatureValues},
     {nullptr, nullptr}
   };
   static const luaL_Reg featureMethods[] = {
@@ -0,0 +1,138 @@
+#include "scan.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/*
+  Finding the positions where a rule whose α starts (or ends) with one or
+  two literal phonemes could match.
+
+  A WString is an array of PUnique objects, each of which is a pointer
+  followed by an `owned` flag. We look at a block of 8 elements at a time
+  and compare the pointers against the phonemes we're looking for. The
+  function that does this is chosen at startup depending on what the CPU
+  supports.
+*/
+
+namespace sca {
+  using Elem = PUnique<const PhonemeSpec>;
+  static_assert(sizeof(Elem) == 2 * sizeof(void*),
+    "PUnique should be a pointer and a flag");
+  constexpr size_t BLOCK = 8;
+  // Return a mask with bit t set if w[t] is `a` and (if `b` is not null)
+  // w[t + 1] is `b`, for t from 0 to BLOCK - 1.
+  using BlockFn = unsigned (*)(
+    const Elem* w, const PhonemeSpec* a, const PhonemeSpec* b);
+#if defined(__x86_64__)
+  // Each element takes up 16 bytes, with the pointer in the lower 8.
+  static unsigned comparePointersSSE2(const Elem* w, const PhonemeSpec* p) {
+    const __m128i* v = reinterpret_cast<const __m128i*>(w);
+    __m128i needle = _mm_set1_epi64x((long long) p);
+    unsigned m = 0;
+    for (size_t t = 0; t < BLOCK; t += 2) {
+      // Put the pointers of two elements side by side. SSE2 doesn't have a
+      // 64-bit comparison, so check that both halves compare equal.
+      __m128i ptrs = _mm_unpacklo_epi64(
+        _mm_loadu_si128(v + t), _mm_loadu_si128(v + t + 1));
+      unsigned bytes = _mm_movemask_epi8(_mm_cmpeq_epi32(ptrs, needle));
+      if ((bytes & 0x00FF) == 0x00FF) m |= 1u << t;
+      if ((bytes & 0xFF00) == 0xFF00) m |= 2u << t;
+    }
+    return m;
+  }
+  static unsigned matchBlockSSE2(
+      const Elem* w, const PhonemeSpec* a, const PhonemeSpec* b) {
+    unsigned m = comparePointersSSE2(w, a);
+    if (b != nullptr && m != 0) m &= comparePointersSSE2(w + 1, b);
+    return m;
+  }
+  __attribute__((target("avx2")))
+  static unsigned comparePointersAVX2(const Elem* w, const PhonemeSpec* p) {
+    const __m256i* v = reinterpret_cast<const __m256i*>(w);
+    __m256i needle = _mm256_set1_epi64x((long long) p);
+    unsigned m = 0;
+    for (size_t t = 0; t < BLOCK; t += 4) {
+      // Each load holds two elements; interleaving two loads gives the
+      // pointers of elements t, t + 2, t + 1, t + 3, which the permutation
+      // puts back in order.
+      __m256i lo = _mm256_loadu_si256(v + t / 2);
+      __m256i hi = _mm256_loadu_si256(v + t / 2 + 1);
+      __m256i ptrs = _mm256_permute4x64_epi64(
+        _mm256_unpacklo_epi64(lo, hi), 0xD8);
+      __m256i eq = _mm256_cmpeq_epi64(ptrs, needle);
+      m |= (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(eq)) << t;
+    }
+    return m;
+  }
+  __attribute__((target("avx2")))
+  static unsigned matchBlockAVX2(
+      const Elem* w, const PhonemeSpec* a, const PhonemeSpec* b) {
+    unsigned m = comparePointersAVX2(w, a);
+    if (b != nullptr && m != 0) m &= comparePointersAVX2(w + 1, b);
+    return m;
+  }
+#else
+  static unsigned matchBlockScalar(
+      const Elem* w, const PhonemeSpec* a, const PhonemeSpec* b) {
+    unsigned m = 0;
+    for (size_t t = 0; t < BLOCK; ++t) {
+      if (w[t].get() == a && (b == nullptr || w[t + 1].get() == b))
+        m |= 1u << t;
+    }
+    return m;
+  }
+#endif
+  static BlockFn selectMatchBlock() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return matchBlockAVX2;
+    return matchBlockSSE2;
+#else
+    return matchBlockScalar;
+#endif
+  }
+  static const BlockFn matchBlock = selectMatchBlock();
+  static bool matchesAt(
+      const WString& word, size_t i,
+      const PhonemeSpec* a, const PhonemeSpec* b) {
+    return word[i].get() == a && (b == nullptr || word[i + 1].get() == b);
+  }
+  // The number of elements after a candidate position that we look at.
+  static size_t extra(const PhonemeSpec* b) { return (b != nullptr) ? 1 : 0; }
+  size_t findLiteral(
+      const WString& word, size_t begin, size_t end,
+      const PhonemeSpec* a, const PhonemeSpec* b) {
+    size_t n = word.size();
+    if (n < 1 + extra(b)) return -1;
+    end = std::min(end, n - extra(b));
+    size_t i = begin;
+    // Each block reads BLOCK + extra(b) elements.
+    for (; i + BLOCK <= end; i += BLOCK) {
+      unsigned m = matchBlock(&word[i], a, b);
+      if (m != 0) return i + __builtin_ctz(m);
+    }
+    for (; i < end; ++i) {
+      if (matchesAt(word, i, a, b)) return i;
+    }
+    return -1;
+  }
+  size_t findLiteralReverse(
+      const WString& word, size_t begin, size_t end,
+      const PhonemeSpec* a, const PhonemeSpec* b) {
+    size_t n = word.size();
+    if (n < 1 + extra(b)) return -1;
+    end = std::min(end, n - extra(b));
+    size_t i = end;
+    for (; i >= begin + BLOCK; i -= BLOCK) {
+      unsigned m = matchBlock(&word[i - BLOCK], a, b);
+      if (m != 0) return i - BLOCK + (31 - __builtin_clz(m));
+    }
+    for (; i > begin; --i) {
+      if (matchesAt(word, i - 1, a, b)) return i - 1;
+    }
+    return -1;
+  }
+}
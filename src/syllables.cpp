@@ -0,0 +1,122 @@
+#include "syllables.h"
+
+#include "SCA.h"
+#include "matching.h"
+
+namespace sca {
+  thread_local Syllables* currentSyllables = nullptr;
+  void Syllabifier::compile(const SCA& sca) {
+    auto compileAll = [&](MString& pattern) {
+      for (MChar& c : pattern)
+        if (c.is<CharMatcher>()) std::get<CharMatcher>(c.value).compile(sca);
+    };
+    compileAll(nuclei);
+    for (MString& pattern : onsets) compileAll(pattern);
+    for (MString& pattern : codas) compileAll(pattern);
+    compiled = false;
+    nucleusIDs = Bitset(sca.getPhonemeCount());
+    for (size_t id = 0; id < sca.getPhonemeCount(); ++id)
+      if (isNucleus(sca, sca.getPhonemeByID(id))) nucleusIDs.set(id);
+    compiled = true;
+  }
+  bool Syllabifier::isNucleus(const SCA& sca, const PhonemeSpec& ps) const {
+    if (compiled && ps.id != -1) return nucleusIDs.test(ps.id);
+    for (const MChar& c : nuclei) {
+      MatchCapture mc;
+      if (charsMatch(sca, c, ps, mc)) return true;
+    }
+    return false;
+  }
+  // Does `pattern` match all of the phonemes from `b` to `e` in `word`?
+  static bool matchesExactly(
+      const SCA& sca, const MString& pattern,
+      const WString& word, size_t b, size_t e) {
+    if (pattern.size() != e - b) return false;
+    MatchCapture mc;
+    for (size_t i = 0; i < pattern.size(); ++i)
+      if (!charsMatch(sca, pattern[i], *word[b + i], mc)) return false;
+    return true;
+  }
+  static bool matchesAny(
+      const SCA& sca, const std::vector<MString>& patterns,
+      const WString& word, size_t b, size_t e) {
+    if (b == e || patterns.empty()) return true;
+    for (const MString& pattern : patterns)
+      if (matchesExactly(sca, pattern, word, b, e)) return true;
+    return false;
+  }
+  size_t Syllabifier::splitCluster(
+      const SCA& sca, const WString& word, size_t b, size_t e) const {
+    // Maximise the onset, as long as what's left is a valid coda...
+    for (size_t k = e - b + 1; k-- > 0;) {
+      if (matchesAny(sca, onsets, word, e - k, e) &&
+          matchesAny(sca, codas, word, b, e - k))
+        return k;
+    }
+    // ... or if there is no such split, just maximise the onset.
+    for (size_t k = e - b; k > 0; --k)
+      if (matchesAny(sca, onsets, word, e - k, e)) return k;
+    return 0;
+  }
+  Syllables::Syllables(
+      const SCA& sca, const Syllabifier& syl, const WString& word) :
+      sca(sca), syl(syl) {
+    reset(word);
+  }
+  void Syllables::reset(const WString& word) {
+    roles.assign(word.size(), SyllableRole::onset);
+    syllables.assign(word.size(), 0);
+    for (size_t i = 0; i < word.size(); ++i) {
+      if (syl.isNucleus(sca, *word[i])) roles[i] = SyllableRole::nucleus;
+    }
+    syllabify(word, 0, word.size());
+  }
+  void Syllables::update(const WString& word, size_t b, size_t e, size_t k) {
+    if (roles.size() - (e - b) + k != word.size()) {
+      // Not the word we were following; start over.
+      reset(word);
+      return;
+    }
+    roles.erase(roles.begin() + b, roles.begin() + e);
+    roles.insert(roles.begin() + b, k, SyllableRole::onset);
+    syllables.erase(syllables.begin() + b, syllables.begin() + e);
+    syllables.insert(syllables.begin() + b, k, 0);
+    for (size_t i = b; i < b + k; ++i) {
+      if (syl.isNucleus(sca, *word[i])) roles[i] = SyllableRole::nucleus;
+    }
+    syllabify(word, b, b + k);
+  }
+  void Syllables::syllabify(const WString& word, size_t b, size_t e) {
+    size_t n = roles.size();
+    while (b > 0 && roles[b - 1] != SyllableRole::nucleus) --b;
+    while (e < n && roles[e] != SyllableRole::nucleus) ++e;
+    // Each run of phonemes between nuclei is shared out between the
+    // syllables on either side of it.
+    for (size_t i = b; i < e;) {
+      if (roles[i] == SyllableRole::nucleus) {
+        ++i;
+        continue;
+      }
+      size_t j = i;
+      while (j < e && roles[j] != SyllableRole::nucleus) ++j;
+      size_t onset = j - i;
+      if (j == n) onset = (i == 0) ? j - i : 0;
+      else if (i != 0) onset = syl.splitCluster(sca, word, i, j);
+      for (size_t m = i; m < j; ++m)
+        roles[m] = (m < j - onset) ? SyllableRole::coda : SyllableRole::onset;
+      i = j;
+    }
+    // Renumber everything from the start of the first syllable that changed.
+    size_t s = (b == 0) ? 0 : syllables[b - 1];
+    for (size_t i = b; i < n; ++i) {
+      if (i != 0 && startsSyllable(i)) ++s;
+      syllables[i] = s;
+    }
+    nSyllables = (n == 0) ? 0 : syllables[n - 1] + 1;
+  }
+  bool Syllables::isClosed(size_t i) const {
+    size_t j = i + 1;
+    while (!startsSyllable(j)) ++j;
+    return roles[j - 1] == SyllableRole::coda;
+  }
+}
@@ -0,0 +1,66 @@
+#include "trace.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <ostream>
+
+#include "Rule.h"
+
+namespace sca {
+  TraceWriter* activeTrace = nullptr;
+  // Events are written out once a thread has this many.
+  constexpr size_t TRACE_CHUNK = 4096;
+  static thread_local std::vector<TraceWriter::Event> pending;
+  static uint32_t getThreadID() {
+    static std::atomic<uint32_t> next(1);
+    static thread_local uint32_t tid = next++;
+    return tid;
+  }
+  TraceWriter::TraceWriter(std::ostream& out) :
+      out(out), epoch(std::chrono::steady_clock::now()) {
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  }
+  TraceWriter::~TraceWriter() {
+    flushThread();
+    out << "\n]}\n";
+  }
+  uint64_t TraceWriter::now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - epoch).count();
+  }
+  void TraceWriter::record(const Event& e) {
+    pending.push_back(e);
+    if (pending.size() >= TRACE_CHUNK) flushThread();
+  }
+  void TraceWriter::flushThread() {
+    write(pending);
+    pending.clear();
+  }
+  void TraceWriter::write(const std::vector<Event>& events) {
+    std::lock_guard<std::mutex> lock(mutex);
+    char buf[128];
+    for (const Event& e : events) {
+      out << (first ? "\n" : ",\n");
+      first = false;
+      // Timestamps are in microseconds.
+      snprintf(buf, sizeof(buf),
+        "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+        "\"ts\": %.3f, \"dur\": %.3f",
+        e.name, e.tid, e.start / 1e3, e.duration / 1e3);
+      out << buf;
+      if (e.line != -1) {
+        out << ", \"args\": {\"line\": " << (e.line + 1) <<
+          ", \"col\": " << (e.col + 1) << "}";
+      }
+      out << "}";
+    }
+  }
+  TraceSpan::~TraceSpan() {
+    if (activeTrace == nullptr) return;
+    size_t line = (rule != nullptr) ? rule->line : -1;
+    size_t col = (rule != nullptr) ? rule->col : -1;
+    activeTrace->record(
+      {name, line, col, start, activeTrace->now() - start, getThreadID()});
+  }
+}
@@ -70,6 +70,100 @@ namespace sca {
       s.verify(errors, sca, sc);
     }
   }
+  // Return the number of characters a string always matches, or -1 if
+  // that can vary.
+  static size_t fixedWidth(MSCI begin, MSCI end) {
+    size_t width = 0;
+    for (MSCI it = begin; it != end; ++it) {
+      size_t w = std::visit([](const auto& arg) -> size_t {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, Space>) {
+          return -1; // only valid at the edges, which we strip off
+        } else if constexpr (std::is_same_v<T, Alternation>) {
+          if (arg.options.empty()) return -1;
+          size_t w0 = fixedWidth(arg.options[0].begin(), arg.options[0].end());
+          for (const MString& opt : arg.options) {
+            if (fixedWidth(opt.begin(), opt.end()) != w0) return -1;
+          }
+          return w0;
+        } else if constexpr (std::is_same_v<T, Repeat>) {
+          if (arg.min != arg.max) return -1;
+          size_t w0 = fixedWidth(arg.s.begin(), arg.s.end());
+          return (w0 == -1) ? -1 : arg.min * w0;
+        } else {
+          return 1;
+        }
+      }, it->value);
+      if (w == -1) return -1;
+      width += w;
+    }
+    return width;
+  }
+  // Return the inventory phoneme that `ch` matches exactly, or null if
+  // it isn't a literal phoneme.
+  static const PhonemeSpec* getLiteral(const SCA& sca, const MChar& ch) {
+    const PhonemeSpec* ps;
+    if (!ch.is<std::string>()) return nullptr;
+    if (!sca.getPhonemeByName(ch.as<std::string>(), ps).ok()) return nullptr;
+    return ps;
+  }
+  static void compileMatchers(MString& s, const SCA& sca) {
+    for (MChar& ch : s) {
+      std::visit([&](auto& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, CharMatcher>) {
+          arg.compile(sca);
+        } else if constexpr (std::is_same_v<T, Alternation>) {
+          for (MString& opt : arg.options) compileMatchers(opt, sca);
+        } else if constexpr (std::is_same_v<T, Repeat>) {
+          compileMatchers(arg.s, sca);
+        }
+      }, ch.value);
+    }
+  }
+  void SimpleRule::classify(const SCA& sca) {
+    compileMatchers(alpha, sca);
+    for (auto& p : envs) {
+      compileMatchers(p.first, sca);
+      compileMatchers(p.second, sca);
+    }
+    size_t n = alpha.size();
+    leading[0] = leading[1] = trailing[0] = trailing[1] = nullptr;
+    if (n >= 1) {
+      leading[0] = getLiteral(sca, alpha[0]);
+      trailing[0] = getLiteral(sca, alpha[n - 1]);
+    }
+    if (n >= 2) {
+      if (leading[0] != nullptr) leading[1] = getLiteral(sca, alpha[1]);
+      if (trailing[0] != nullptr) trailing[1] = getLiteral(sca, alpha[n - 2]);
+    }
+    anchoring = Anchoring();
+    anchoring.width = fixedWidth(alpha.begin(), alpha.end());
+    if (inv || envs.empty()) return;
+    // A rule is anchored on one side only if every environment anchors
+    // it the same way on that side.
+    for (size_t i = 0; i < envs.size(); ++i) {
+      const MString& lambda = envs[i].first;
+      const MString& rho = envs[i].second;
+      size_t left = -1, right = -1;
+      if (!lambda.empty() && lambda.front().is<Space>())
+        left = fixedWidth(lambda.begin() + 1, lambda.end());
+      if (!rho.empty() && rho.back().is<Space>())
+        right = fixedWidth(rho.begin(), rho.end() - 1);
+      if (i == 0) {
+        anchoring.left = left;
+        anchoring.right = right;
+      } else {
+        if (anchoring.left != left) anchoring.left = -1;
+        if (anchoring.right != right) anchoring.right = -1;
+      }
+    }
+  }
+  void CompoundRule::classify(const SCA& sca) {
+    for (SimpleRule& s : components) {
+      s.classify(sca);
+    }
+  }
   static bool hasMatcher(
       const DependentConstraintVerifyContext& ctx,
       const P& p) {
@@ -197,6 +291,30 @@ namespace sca {
               }
             }
           }
+          // Groups can't refer to other matchers, and can't be used in ω
+          if (!write && !arg.groups.empty()) {
+            errors.push_back((ErrorCode::groupInOmega % asString)
+              .at(ctx.line, ctx.col));
+          }
+          for (const CharMatcher::Group& g : arg.groups) {
+            for (const auto& opt : g.options) {
+              for (const CharMatcher::Constraint& con : opt) {
+                std::string cstring = con.toString(sca);
+                if (con.isDependent()) {
+                  errors.push_back(
+                    (ErrorCode::dependentConstraintInGroup % cstring)
+                    .at(ctx.line, ctx.col));
+                }
+                const Feature& f = sca.getFeatureByID(con.feature);
+                if (!f.ordered &&
+                    con.c != Comparison::eq && con.c != Comparison::ne) {
+                  errors.push_back(
+                    (ErrorCode::orderedConstraintUnorderedFeature % cstring)
+                    .at(ctx.line, ctx.col));
+                }
+              }
+            }
+          }
           // Check miscellaneous things:
           // Labelled and unlabelled matchers mixed?
           bool unlabelled = arg.index == 0;
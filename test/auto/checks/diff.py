@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+
+# --diff applies the sound changes that both scripts start with only once,
+# and still prints the same words as it would without sharing them.
+
+from pathlib import Path
+import re
+import subprocess
+import sys
+import tempfile
+
+execPath = sys.argv[1]
+casesDir = Path(sys.argv[2]) / "auto/cases"
+oldScript = (casesDir / "stages/40-diff-old.zt").read_text()
+newScript = (casesDir / "40-diff.zt").read_text()
+words = casesDir / "words-40-diff.txt"
+
+failed = False
+def check(ok, what):
+  global failed
+  if not ok:
+    print("failed:", what)
+    failed = True
+
+# Return the number of sound changes shared and the lines printed.
+def diff(old, new):
+  with tempfile.TemporaryDirectory() as d:
+    d = Path(d)
+    (d / "old.zt").write_text(old)
+    (d / "new.zt").write_text(new)
+    p = subprocess.run(
+      [execPath, "-v", "--diff", str(d / "old.zt"), str(d / "new.zt"),
+        str(words)],
+      capture_output=True, encoding="utf8", check=True)
+  m = re.search(r"^Applying (\d+) of (\d+) sound changes once", p.stderr,
+    re.MULTILINE)
+  shared = int(m.group(1)) if m else None
+  return shared, [l for l in p.stdout.splitlines() if ": " in l]
+
+expected = (casesDir / "expected-40-diff.txt").read_text().splitlines()
+
+# Only the last sound change differs.
+shared, lines = diff(oldScript, newScript)
+check(shared == 3, "{} sound changes shared, expected 3".format(shared))
+check(lines == expected, "the output with 3 shared is {}".format(lines))
+
+# The scripts differ before the first sound change, so nothing can be
+# shared, but the output is the same.
+first = "$(C:1|voice=n)"
+assert first in newScript
+shared, lines = diff(
+  oldScript, newScript.replace(first, "# Voicing\n" + first, 1))
+check(shared == 0, "{} sound changes shared, expected 0".format(shared))
+check(lines == expected, "the output with none shared is {}".format(lines))
+
+# The same script: everything is shared, and nothing is printed.
+shared, lines = diff(newScript, newScript)
+check(shared == 4, "{} sound changes shared, expected 4".format(shared))
+check(lines == [], "identical scripts print {}".format(lines))
+
+sys.exit(1 if failed else 0)
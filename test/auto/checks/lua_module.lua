@@ -0,0 +1,104 @@
+-- The zt module for Lua: load, apply, applyBatch and setLimits.
+-- Skipped unless the module was built (with -DSCA_BUILD_LUA_MODULE=ON),
+-- in which case it's next to the executable.
+
+local execPath, testDir = arg[1], arg[2]
+local buildDir = execPath:match("^(.*)/[^/]*$") or "."
+local fh = io.open(buildDir .. "/zt.so")
+if fh == nil then
+  print("the Lua module wasn't built")
+  os.exit(77)
+end
+fh:close()
+package.cpath = buildDir .. "/?.so;" .. package.cpath
+local zt = require "zt"
+local cases = testDir .. "/auto/cases/"
+
+local failed = false
+local function check(ok, what)
+  if not ok then
+    print("failed: " .. what)
+    failed = true
+  end
+end
+
+-- Loading
+local pos = assert(zt.load(cases .. "22-pos.zt"))
+local script, err = zt.load(cases .. "no-such-script.zt")
+check(script == nil and err:find("could not open"), "load a missing file")
+script, err = zt.loadString("a -> ;;")
+check(script == nil and type(err) == "string", "loadString a bad script")
+local limited = assert(zt.loadString([[
+class C = p t k d;
+t -> d / loopsi;
+e -> i i i / loopnsi;
+]]))
+
+-- apply
+check(pos:apply("a", "n") == "d", "apply with a part of speech")
+check(pos:apply("a") == "a", "apply without one")
+local out, errs = pos:apply("b", "v")
+check(out == "d" and errs == nil, "apply returns no errors")
+
+-- setLimits
+limited:setLimits{replacements = 3, growth = 4}
+out, errs = limited:apply("tatatata")
+check(out == "dadadata", "apply stops at the replacement limit")
+check(type(errs) == "string" and errs:find("more than 3 replacements"),
+  "apply reports the replacement limit")
+out, errs = limited:apply("kekete")
+check(out == "kiiikiiide" and errs:find("grew by more than 4"),
+  "apply reports the growth limit")
+check(not pcall(limited.setLimits, limited, {growth = -1}),
+  "negative limits are rejected")
+limited:setLimits{}
+out, errs = limited:apply("tatatata")
+check(out == "dadadada" and errs == nil, "limits can be removed")
+
+-- applyBatch gives the same results as apply, on any number of threads.
+local letters = {"a", "b", "c", "d", "e", "f"}
+local poses = {"n", "v", "adj", "x"}
+local words, wordPoses = {}, {}
+math.randomseed(1)
+for i = 1, 500 do
+  local w = {}
+  for j = 1, math.random(1, 6) do w[j] = letters[math.random(#letters)] end
+  words[i] = table.concat(w)
+  wordPoses[i] = poses[math.random(#poses)]
+end
+for _, threads in ipairs({1, 4, 0}) do
+  local outs, batchErrs = pos:applyBatch(words, wordPoses, threads)
+  local same = #outs == #words and next(batchErrs) == nil
+  for i = 1, #words do
+    same = same and outs[i] == pos:apply(words[i], wordPoses[i])
+  end
+  check(same, "applyBatch with a table of parts of speech on " ..
+    threads .. " threads")
+  outs = pos:applyBatch(words, "n", threads)
+  same = #outs == #words
+  for i = 1, #words do
+    same = same and outs[i] == pos:apply(words[i], "n")
+  end
+  check(same, "applyBatch with one part of speech on " ..
+    threads .. " threads")
+end
+local outs = pos:applyBatch({})
+check(#outs == 0, "applyBatch with no words")
+
+limited:setLimits{replacements = 3}
+local batchErrs
+outs, batchErrs = limited:applyBatch({"tata", "tatatata", "pe"}, nil, 2)
+check(outs[1] == "dada" and outs[2] == "dadadata" and outs[3] == "piii",
+  "applyBatch stops at the replacement limit")
+check(batchErrs[1] == nil and batchErrs[2]:find("more than 3 replacements")
+  and batchErrs[3] == nil, "applyBatch reports errors by index")
+
+-- Bad arguments raise errors.
+check(not pcall(pos.applyBatch, pos, {"a", 1}), "words must be strings")
+check(not pcall(pos.applyBatch, pos, {"a"}, {true}),
+  "parts of speech must be strings")
+check(not pcall(pos.applyBatch, pos, {"a"}, nil, -1),
+  "the number of threads must not be negative")
+check(not pcall(pos.apply, pos), "apply needs a word")
+
+os.exit(failed and 1 or 0)
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+
+# --profile-json writes valid JSON with an entry for each sound change, in
+# order, and its counts don't depend on whether the sound changes were
+# fused (they aren't fused in verbose mode).
+
+import json
+from pathlib import Path
+import subprocess
+import sys
+import tempfile
+
+execPath = sys.argv[1]
+casesDir = Path(sys.argv[2]) / "auto/cases"
+script = casesDir / "25-fusion.zt"
+words = casesDir / "words-25-fusion.txt"
+
+def profile(*args):
+  with tempfile.TemporaryDirectory() as d:
+    path = Path(d) / "profile.json"
+    subprocess.run(
+      [execPath, "--profile-json", str(path), *args, str(script), str(words)],
+      stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+    with path.open() as fh:
+      return json.load(fh)
+
+fused = profile()
+separate = profile("-v")
+
+# Each line of the script with -> on it has a sound change.
+expected = [
+  i + 1 for i, line in enumerate(script.read_text().splitlines())
+  if "->" in line and not line.startswith("#")]
+got = [r["line"] for r in fused]
+if got != expected or got != [r["line"] for r in separate]:
+  sys.exit("sound changes on lines {}, expected {}".format(got, expected))
+
+counters = [
+  "candidates", "alphaMatches", "envRejections", "gammaEvaluations",
+  "gammaCacheHits", "replacements"]
+failed = False
+for f, s in zip(fused, separate):
+  for c in counters:
+    if f[c] != s[c]:
+      print("{}:{}: {} is {} when fused but {} otherwise".format(
+        f["line"], f["col"], c, f[c], s[c]))
+      failed = True
+if sum(r["replacements"] for r in fused) == 0:
+  print("nothing was replaced")
+  failed = True
+sys.exit(1 if failed else 0)
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+
+# The zt module for Python: apply_many gives the same results as apply,
+# on any number of threads, and errors are reported. Skipped unless the
+# module was built (with -DSCA_BUILD_PYTHON_MODULE=ON).
+
+from pathlib import Path
+import random
+import sys
+import threading
+
+execPath = Path(sys.argv[1])
+casesDir = Path(sys.argv[2]) / "auto/cases"
+moduleDir = execPath.parent / "python"
+if not (moduleDir / "zt.so").exists():
+  print("the Python module wasn't built")
+  sys.exit(77)
+sys.path.insert(0, str(moduleDir))
+import zt
+
+failed = False
+def check(ok, what):
+  global failed
+  if not ok:
+    print("failed:", what)
+    failed = True
+
+pos = zt.Script.load(str(casesDir / "22-pos.zt"))
+# This uses Lua, so each thread gets its own copy of the script.
+gamma = zt.Script.from_string(
+  "class C = t d;\n"
+  "executeOnce $$ n = 2 $$\n"
+  "t -> d $$ M.s > n $$ / loopsi;\n")
+
+random.seed(1)
+words = [
+  "".join(random.choice("abcdeft") for _ in range(random.randint(1, 8)))
+  for _ in range(2000)]
+items = [(w, random.choice(["n", "v", "adj", "x", None])) for w in words]
+
+# apply_many is the same as calling apply on each item.
+for script in [pos, gamma]:
+  serial = [script.apply(w, p or "") for w, p in items]
+  for threads in [0, 1, 3, 8]:
+    check(script.apply_many(items, threads=threads) == serial,
+      "apply_many with {} threads".format(threads))
+  check(script.apply_many(iter(items)) == serial, "apply_many on an iterator")
+  check(script.apply_many(words) == [script.apply(w) for w in words],
+    "apply_many on words without parts of speech")
+check(pos.apply_many([]) == [], "apply_many on nothing")
+
+# ... even when it's called from several Python threads at once.
+serial = [gamma.apply(w, p or "") for w, p in items]
+results = [None] * 4
+def run(i):
+  results[i] = gamma.apply_many(items, threads=2)
+ts = [threading.Thread(target=run, args=(i,)) for i in range(len(results))]
+for t in ts: t.start()
+for t in ts: t.join()
+check(all(r == serial for r in results), "concurrent calls to apply_many")
+
+# ... or apply is called from other threads while apply_many runs.
+applied = [None] * 4
+def runApply(i):
+  applied[i] = [gamma.apply(w, p or "") for w, p in items[:200]]
+ts = [threading.Thread(target=run, args=(0,))]
+ts += [
+  threading.Thread(target=runApply, args=(i,)) for i in range(len(applied))]
+for t in ts: t.start()
+for t in ts: t.join()
+check(results[0] == serial and all(a == serial[:200] for a in applied),
+  "apply while apply_many runs")
+
+# return_errors
+limited = zt.Script.from_string("class C = t d;\nt -> d / loopsi;\n")
+limited.set_limits(replacements=2)
+out, errors = limited.apply("tatata", return_errors=True)
+check(out == "dadata", "apply stops at the limit")
+check(len(errors) == 1 and "more than 2 replacements" in errors[0],
+  "apply returns the errors")
+check(limited.apply("ta", return_errors=True) == ("da", []),
+  "apply returns no errors")
+outs, errors = limited.apply_many(["tatata", "ta", "a"] * 50,
+  threads=4, return_errors=True)
+check(outs == ["dadata", "da", "a"] * 50, "apply_many stops at the limit")
+check(all(len(e) == 1 for e in errors[::3]) and
+  all(e == [] for i, e in enumerate(errors) if i % 3 != 0),
+  "apply_many returns the errors for each word")
+limited.set_limits()
+check(limited.apply("tatata") == "dadada", "limits can be removed")
+
+# Errors raise exceptions.
+def raises(exception, f, what):
+  try:
+    f()
+  except exception:
+    return
+  except Exception as e:
+    check(False, "{} raised {!r}".format(what, e))
+    return
+  check(False, "{} didn't raise {}".format(what, exception.__name__))
+raises(zt.Error, lambda: zt.Script.from_string("a -> ;;"), "a bad script")
+raises(zt.Error, lambda: zt.Script.load(str(casesDir / "29-groups-bogus.zt")),
+  "loading a bad script")
+raises(OSError, lambda: zt.Script.load(str(casesDir / "no-such-script.zt")),
+  "loading a missing file")
+raises(TypeError, lambda: pos.apply_many([1]), "a word that isn't a string")
+raises(TypeError, lambda: pos.apply_many([("a", "n", "v")]), "a triple")
+raises(ValueError, lambda: pos.apply_many(["a"], threads=-1),
+  "a negative number of threads")
+raises(ValueError, lambda: pos.set_limits(growth=-1), "a negative limit")
+check(issubclass(zt.Error, Exception), "zt.Error is an exception")
+
+sys.exit(1 if failed else 0)
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+
+# --trace writes a valid Chrome trace, with one event for each time a
+# sound change is applied to a word.
+
+from collections import Counter
+import json
+from pathlib import Path
+import subprocess
+import sys
+import tempfile
+
+execPath = sys.argv[1]
+
+# None of these sound changes can be fused, so each one gets its own event.
+script = """\
+class C = p t k;
+class V = a e i;
+a -> e (_ $(C));
+k -> ;
+-> i (t _ ~);
+e e -> a / loopsi;
+"""
+words = ["pata", "kaki", "tee", "eeeet", "a"]
+
+with tempfile.TemporaryDirectory() as d:
+  d = Path(d)
+  (d / "script.zt").write_text(script)
+  (d / "words.txt").write_text("".join(w + "\n" for w in words))
+  subprocess.run(
+    [execPath, "--trace", str(d / "trace.json"), str(d / "script.zt"),
+      str(d / "words.txt")],
+    stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+  with (d / "trace.json").open() as fh:
+    trace = json.load(fh)
+
+failed = False
+def fail(message):
+  global failed
+  print(message)
+  failed = True
+
+events = trace["traceEvents"]
+for e in events:
+  for key in ["name", "ph", "pid", "tid", "ts", "dur"]:
+    if key not in e: fail("event {} has no {}".format(e, key))
+  if e.get("ph") != "X": fail("event {} is not complete".format(e))
+  if e.get("dur", 0) < 0: fail("event {} has a negative duration".format(e))
+
+names = Counter(e["name"] for e in events)
+if names["word"] != len(words):
+  fail("{} word events for {} words".format(names["word"], len(words)))
+if names["fused rules"] != 0:
+  fail("{} fused events".format(names["fused rules"]))
+
+# Each sound change is applied once to each word.
+ruleLines = [
+  i + 1 for i, line in enumerate(script.splitlines()) if "->" in line]
+applied = Counter(e["args"]["line"] for e in events if e["name"] == "rule")
+expected = Counter({line: len(words) for line in ruleLines})
+if applied != expected:
+  fail("rule events on lines {}, expected {}".format(
+    dict(applied), dict(expected)))
+sys.exit(1 if failed else 0)
@@ -1,7 +1,9 @@
 #!/usr/bin/env python3
 
 import difflib
+import os
 from pathlib import Path
+import shutil
 import subprocess
 import sys
 
@@ -26,7 +28,12 @@ for ztPath in allCases:
   expout = casesDir / ("expected-" + caseName + ".txt")
   output = outputDir / ("actual-" + caseName + ".txt")
   diffpath = outputDir / (caseName + ".diff")
-  p = subprocess.run([execPath, str(ztPath), str(inp)],
+  # Extra command-line options, if any, go in args-<case>.txt, where
+  # {cases} stands for the directory of the test cases
+  argsPath = casesDir / ("args-" + caseName + ".txt")
+  args = argsPath.read_text().split() if argsPath.exists() else []
+  args = [a.replace("{cases}", str(casesDir)) for a in args]
+  p = subprocess.run([execPath, *args, str(ztPath), str(inp)],
     stdout=subprocess.PIPE, stderr=subprocess.STDOUT, encoding="utf8")
   actualStr = p.stdout
   with output.open("w") as fh:
@@ -51,6 +58,43 @@ for ztPath in allCases:
       print("Test {} passed".format(caseName), file=sys.stderr)
       nPass += 1
 
-print("{} passed, {} failed".format(nPass, nFail), file=sys.stderr)
+# Other checks are scripts in auto/checks, which are given the path to the
+# executable and the test directory. Python checks are run with this
+# interpreter, and Lua checks with the one in $LUA (or lua on the PATH).
+# A check that exits with status 77 was skipped, for instance because the
+# module that it tests wasn't built.
+SKIPPED = 77
+nSkip = 0
+luaPath = os.environ.get("LUA") or shutil.which("lua")
+
+for checkPath in sorted((testDir / "auto/checks").glob("*")):
+  if checkPath.suffix == ".py":
+    interpreter = sys.executable
+  elif checkPath.suffix == ".lua":
+    interpreter = luaPath
+  else:
+    continue
+  if interpreter is None:
+    status = SKIPPED
+    out = "no interpreter for {}\n".format(checkPath.name)
+  else:
+    p = subprocess.run([interpreter, str(checkPath), execPath, str(testDir)],
+      stdout=subprocess.PIPE, stderr=subprocess.STDOUT, encoding="utf8")
+    status = p.returncode
+    out = p.stdout
+  if status == 0:
+    print("Check {} passed".format(checkPath.stem), file=sys.stderr)
+    nPass += 1
+  elif status == SKIPPED:
+    print("Check {} skipped: {}".format(checkPath.stem, out.strip()),
+      file=sys.stderr)
+    nSkip += 1
+  else:
+    print("Check {} failed".format(checkPath.stem), file=sys.stderr)
+    sys.stderr.write(out)
+    nFail += 1
+
+print("{} passed, {} failed, {} skipped".format(nPass, nFail, nSkip),
+  file=sys.stderr)
 
 if nFail != 0: sys.exit(1)